@@ -0,0 +1,343 @@
+/*
+ * bench_hamming.c  —  Microbenchmark for the kernels in hamming.h
+ *
+ * Build:
+ *   gcc -O2 -Wall -Wextra -std=c99 -o bench_hamming bench_hamming.c $(pkg-config --cflags --libs zvbi)
+ *   gcc -O2 -Wall -Wextra -std=c99 -DTTXD_NO_ZVBI -o bench_hamming bench_hamming.c
+ *
+ * Usage:
+ *   bench_hamming [passes]        (default 500)
+ *
+ * First checks every kernel against the scalar tables, and against
+ * libzvbi where it is linked in.  Then it times decoding a set of
+ * 4096 random 42-byte teletext packets (small enough to stay in L2,
+ * as a stream's recent PES data would) the given number of times:
+ *
+ *   address   two Hamming 8/4 bytes per packet
+ *   row       40 parity-coded bytes per packet
+ *   triplet   Hamming 24/18, 13 triplets per packet (as in X/26)
+ *
+ * The libzvbi columns call vbi_rev8() and then vbi_unham8(),
+ * vbi_unpar8() or vbi_unham24p() per byte or triplet.  That is the
+ * work the daemon does today, split between vbi_dvb_demux_cor() and
+ * vbi_decode().
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef TTXD_NO_ZVBI
+#include <libzvbi.h>
+#define HAVE_ZVBI 1
+#endif
+
+#include "hamming.h"
+#include "ttxd_charset.h"
+
+#define PKT_SIZE 42
+#define NPKTS    4096
+
+static uint8_t  g_pkts[NPKTS * PKT_SIZE];
+static int      g_npkts;                /* NPKTS × passes              */
+static volatile uint64_t g_sink;        /* keeps results alive         */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Encode 18 data bits as a Hamming 24/18 triplet in PES byte order   */
+static void enc2418(uint8_t *p, uint32_t d)
+{
+    uint32_t w = ((d & 0x1) << 2) | ((d & 0xE) << 3) |
+                 ((d & 0x7F0) << 4) | ((d & 0x3F800) << 5);
+
+    for (int k = 0; k < 5; k++) {
+        int par = 0;
+        for (int pos = 1; pos < 24; pos++)
+            if ((pos >> k) & 1) par ^= (w >> (pos - 1)) & 1;
+        if (!par) w |= 1u << ((1 << k) - 1);
+    }
+    if (!__builtin_parity(w)) w |= 1u << 23;
+
+    for (int i = 0; i < 3; i++)
+        p[i] = ham_rev8[(w >> (8 * i)) & 0xFF];
+}
+
+/* ------------------------------------------------------------------ */
+/* Correctness                                                         */
+/* ------------------------------------------------------------------ */
+static int check(void)
+{
+    int fail = 0;
+
+    /* Row kernels against the byte tables, on random rows of every   */
+    /* length up to 64                                                 */
+    ham_par_row_fn kern[3] = { par_row_scalar, NULL, NULL };
+    const char    *name[3] = { "scalar", "ssse3", "avx2" };
+#ifdef HAM_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) kern[1] = par_row_ssse3;
+    if (__builtin_cpu_supports("avx2"))  kern[2] = par_row_avx2;
+#endif
+    for (int k = 0; k < 3; k++) {
+        if (!kern[k]) continue;
+        for (int n = 1; n <= 64; n++) {
+            uint8_t in[64], out[64];
+            for (int i = 0; i < n; i++) in[i] = (uint8_t)rand();
+            uint64_t bad = kern[k](out, in, n);
+            for (int i = 0; i < n; i++) {
+                int want = par7(in[i]);
+                int got  = (bad >> i) & 1 ? 0xFF : out[i];
+                if (want != got) {
+                    printf("FAIL %s n=%d byte %d: %02x -> %02x, want %02x\n",
+                           name[k], n, i, in[i], got, want);
+                    fail = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Hamming 24/18: every data word, clean and with each single    */
+    /* bit flipped; two flipped bits must be rejected                 */
+    for (uint32_t d = 0; d < (1u << 18); d++) {
+        uint8_t p[3];
+        enc2418(p, d);
+        if (ham2418(p) != (int)d) {
+            printf("FAIL ham2418 clean %05x -> %d\n", d, ham2418(p));
+            fail = 1;
+            break;
+        }
+        int b1 = rand() % 24, b2 = (b1 + 1 + rand() % 23) % 24;
+        p[b1 / 8] ^= (uint8_t)(1 << (b1 % 8));
+        if (ham2418(p) != (int)d) {
+            printf("FAIL ham2418 single error %05x bit %d\n", d, b1);
+            fail = 1;
+            break;
+        }
+        p[b2 / 8] ^= (uint8_t)(1 << (b2 % 8));
+        if (ham2418(p) >= 0) {
+            printf("FAIL ham2418 double error %05x bits %d,%d\n", d, b1, b2);
+            fail = 1;
+            break;
+        }
+    }
+
+    /* A German page header: C14 alone set in byte 9, and "[" and "~" */
+    /* in the text must come out as Ä and ß                            */
+    {
+        uint8_t ham[16], par[128], hdr[PKT_SIZE], chr[32];
+        const uint8_t text[] = "ZDFtext [~ 100";
+        int h[8], n = (int)sizeof text - 1;
+
+        /* Encode by inverting the tables; any byte that decodes to  */
+        /* the wanted value will do                                   */
+        for (int b = 0; b < 256; b++) {
+            if (ham84(b) >= 0)   ham[ham84(b)] = (uint8_t)b;
+            if (par7(b) != 0xFF) par[par7(b)] = (uint8_t)b;
+        }
+        memset(hdr, ham[0], 10);
+        hdr[9] = ham[0x8];
+        for (int i = 0; i < n; i++) hdr[10 + i] = par[text[i]];
+
+        for (int i = 0; i < 8; i++) h[i] = ham84(hdr[2 + i]);
+        int nat = ttxd_national(h[7]);
+        uint64_t bad = ham_par_row(chr, hdr + 10, n);
+        unsigned int ae = ttxd_g0(nat, chr[8]), sz = ttxd_g0(nat, chr[9]);
+        if (nat != 1 || bad || ae != 0x00C4 || sz != 0x00DF) {
+            printf("FAIL German header: national %d, U+%04X U+%04X\n",
+                   nat, ae, sz);
+            fail = 1;
+        }
+    }
+
+#ifdef HAVE_ZVBI
+    for (int b = 0; b < 256; b++) {
+        int r = vbi_rev8(b);
+        if (ham84(b) != vbi_unham8(r)) {
+            printf("FAIL ham84 %02x: %d, libzvbi %d\n", b, ham84(b),
+                   vbi_unham8(r));
+            fail = 1;
+        }
+        int zp = vbi_unpar8(r);
+        if (par7(b) != (zp < 0 ? 0xFF : zp)) {
+            printf("FAIL par7 %02x: %d, libzvbi %d\n", b, par7(b), zp);
+            fail = 1;
+        }
+    }
+    for (int i = 0; i < 100000; i++) {
+        uint8_t p[3], r[3];
+        enc2418(p, (uint32_t)rand() & 0x3FFFF);
+        if (i & 1) p[rand() % 3] ^= (uint8_t)(1 << (rand() % 8));
+        for (int k = 0; k < 3; k++) r[k] = (uint8_t)vbi_rev8(p[k]);
+        if (ham2418(p) != vbi_unham24p(r)) {
+            printf("FAIL ham2418 %02x%02x%02x: %d, libzvbi %d\n",
+                   p[0], p[1], p[2], ham2418(p), vbi_unham24p(r));
+            fail = 1;
+            break;
+        }
+    }
+#endif
+
+    printf("self-check: %s\n", fail ? "FAILED" : "ok");
+    return !fail;
+}
+
+/* ------------------------------------------------------------------ */
+/* Timed loops, one per kernel                                         */
+/* ------------------------------------------------------------------ */
+static void bench_addr_table(void)
+{
+    uint64_t acc = 0;
+    for (int i = 0; i < g_npkts; i++)
+        acc += (uint64_t)ham84_pair(g_pkts + (size_t)(i % NPKTS) * PKT_SIZE);
+    g_sink += acc;
+}
+
+static void bench_row_bytes(void)
+{
+    uint64_t acc = 0;
+    for (int i = 0; i < g_npkts; i++) {
+        const uint8_t *p = g_pkts + (size_t)(i % NPKTS) * PKT_SIZE + 2;
+        for (int k = 0; k < 40; k++) acc += (uint64_t)par7(p[k]);
+    }
+    g_sink += acc;
+}
+
+static ham_par_row_fn g_kernel;
+
+static void bench_row_kernel(void)
+{
+    uint64_t acc = 0;
+    uint8_t  out[40];
+    for (int i = 0; i < g_npkts; i++) {
+        acc += g_kernel(out, g_pkts + (size_t)(i % NPKTS) * PKT_SIZE + 2, 40);
+        acc += out[i % 40];
+    }
+    g_sink += acc;
+}
+
+static void bench_triplet_table(void)
+{
+    uint64_t acc = 0;
+    for (int i = 0; i < g_npkts; i++) {
+        const uint8_t *p = g_pkts + (size_t)(i % NPKTS) * PKT_SIZE + 3;
+        for (int t = 0; t < 13; t++) acc += (uint64_t)ham2418(p + 3 * t);
+    }
+    g_sink += acc;
+}
+
+#ifdef HAVE_ZVBI
+static void bench_addr_zvbi(void)
+{
+    uint64_t acc = 0;
+    for (int i = 0; i < g_npkts; i++) {
+        const uint8_t *p = g_pkts + (size_t)(i % NPKTS) * PKT_SIZE;
+        acc += (uint64_t)(vbi_unham8(vbi_rev8(p[0])) |
+                          vbi_unham8(vbi_rev8(p[1])) << 4);
+    }
+    g_sink += acc;
+}
+
+static void bench_row_zvbi(void)
+{
+    uint64_t acc = 0;
+    for (int i = 0; i < g_npkts; i++) {
+        const uint8_t *p = g_pkts + (size_t)(i % NPKTS) * PKT_SIZE + 2;
+        for (int k = 0; k < 40; k++)
+            acc += (uint64_t)vbi_unpar8(vbi_rev8(p[k]));
+    }
+    g_sink += acc;
+}
+
+static void bench_triplet_zvbi(void)
+{
+    uint64_t acc = 0;
+    for (int i = 0; i < g_npkts; i++) {
+        const uint8_t *p = g_pkts + (size_t)(i % NPKTS) * PKT_SIZE + 3;
+        for (int t = 0; t < 13; t++) {
+            uint8_t r[3] = { (uint8_t)vbi_rev8(p[3 * t]),
+                             (uint8_t)vbi_rev8(p[3 * t + 1]),
+                             (uint8_t)vbi_rev8(p[3 * t + 2]) };
+            acc += (uint64_t)vbi_unham24p(r);
+        }
+    }
+    g_sink += acc;
+}
+#endif
+
+static void run(const char *what, void (*fn)(void), int units)
+{
+    fn();                               /* warm up                     */
+    double t0 = now();
+    fn();
+    double dt = now() - t0;
+    printf("  %-24s %8.2f ns/packet  %8.3f ns/unit\n", what,
+           dt * 1e9 / g_npkts, dt * 1e9 / ((double)g_npkts * units));
+}
+
+/* ------------------------------------------------------------------ */
+int main(int argc, char *argv[])
+{
+    int passes = argc > 1 ? atoi(argv[1]) : 500;
+    if (passes <= 0) {
+        fprintf(stderr, "Usage: %s [passes]\n", argv[0]);
+        return 1;
+    }
+    g_npkts = NPKTS * passes;
+
+    ham_init();
+    srand(1);
+    if (!check()) return 1;
+
+    /* Valid packets with a sprinkling of bit errors, as on air       */
+    for (size_t i = 0; i < sizeof(g_pkts); i++) {
+        uint8_t c = (uint8_t)(0x20 + rand() % 0x5F);
+        if (__builtin_parity(c) == 0) c |= 0x80;
+        c = ham_rev8[c];
+        if (rand() % 1000 == 0) c ^= (uint8_t)(1 << (rand() % 8));
+        g_pkts[i] = c;
+    }
+
+    printf("%d packets x %d passes\n", NPKTS, passes);
+
+    printf("address (Hamming 8/4, unit = byte pair)\n");
+    run("ham84_pair", bench_addr_table, 1);
+#ifdef HAVE_ZVBI
+    run("libzvbi unham8", bench_addr_zvbi, 1);
+#endif
+
+    printf("row (odd parity, unit = byte)\n");
+    run("par7 per byte", bench_row_bytes, 40);
+    g_kernel = par_row_scalar;
+    run("par_row_scalar", bench_row_kernel, 40);
+#ifdef HAM_X86_SIMD
+    if (__builtin_cpu_supports("ssse3")) {
+        g_kernel = par_row_ssse3;
+        run("par_row_ssse3", bench_row_kernel, 40);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        g_kernel = par_row_avx2;
+        run("par_row_avx2", bench_row_kernel, 40);
+    }
+#endif
+#ifdef HAVE_ZVBI
+    run("libzvbi unpar8", bench_row_zvbi, 40);
+#endif
+
+    printf("triplet (Hamming 24/18, unit = triplet)\n");
+    run("ham2418", bench_triplet_table, 13);
+#ifdef HAVE_ZVBI
+    run("libzvbi unham24p", bench_triplet_zvbi, 13);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * hamming.h  —  Teletext error coding kernels (EN 300 706 §8)
+ *
+ *   Hamming 8/4    packet addresses, page header fields
+ *   odd parity     display bytes of every row
+ *   Hamming 24/18  packets X/26, X/27 (format 2), X/28 and M/29
+ *
+ * Every function takes bytes as they appear in a DVB PES (EN 300 472),
+ * i.e. bit-reversed relative to the VBI line.  The bit reversal is
+ * folded into the tables, so there is no separate pass; libzvbi does
+ * the same work as vbi_rev8() followed by vbi_unham8()/vbi_unpar8().
+ *
+ * Header only: all functions are static inline, so ttxd.c and
+ * bench_hamming.c each get their own copy.  Call ham_init() once
+ * before anything else.
+ */
+#ifndef TTXD_HAMMING_H
+#define TTXD_HAMMING_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* SSE2 is baseline on x86-64; SSSE3 and AVX2 are picked at run time  */
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define HAM_X86_SIMD 1
+#endif
+
+static uint8_t ham_rev8[256];           /* bit reversal                */
+static int8_t  ham84_tab[256];          /* Hamming 8/4 → nibble, -1 bad */
+static uint8_t par7_tab[256];           /* odd parity → 7 bits, 0xFF bad */
+static uint8_t ham2418_syn[3][256];     /* per-byte syndrome share     */
+
+/* ------------------------------------------------------------------ */
+/* Scalar decoders                                                     */
+/* ------------------------------------------------------------------ */
+
+/* One Hamming 8/4 byte: data nibble, or -1 if two bits are wrong     */
+static inline int ham84(uint8_t b)
+{
+    return ham84_tab[b];
+}
+
+/* Two Hamming 8/4 bytes, low nibble first: 8 bits, or -1            */
+static inline int ham84_pair(const uint8_t *p)
+{
+    int lo = ham84_tab[p[0]], hi = ham84_tab[p[1]];
+    return (lo < 0 || hi < 0) ? -1 : lo | hi << 4;
+}
+
+/* One parity-coded byte: 7-bit character, or 0xFF on even parity    */
+static inline int par7(uint8_t b)
+{
+    return par7_tab[b];
+}
+
+/* Hamming 24/18 triplet: 18 data bits, or -1 if uncorrectable.       */
+/*                                                                     */
+/* Bit positions 1..24 on the line; P1, P2, P3, P4, P5 sit at 1, 2,   */
+/* 4, 8, 16 and check odd parity over the positions whose index has   */
+/* that bit set, P6 at 24 makes the whole triplet odd.  XOR-ing the   */
+/* positions of all set bits therefore gives 0x1F for a good triplet, */
+/* and the position of the flipped bit for a single error.  The       */
+/* tables hold each byte's share of that XOR.                         */
+static inline int ham2418(const uint8_t *p)
+{
+    int syn = ham2418_syn[0][p[0]] ^ ham2418_syn[1][p[1]] ^
+              ham2418_syn[2][p[2]] ^ 0x1F;
+    uint32_t w = (uint32_t)ham_rev8[p[0]] |
+                 (uint32_t)ham_rev8[p[1]] << 8 |
+                 (uint32_t)ham_rev8[p[2]] << 16;
+
+    if (!__builtin_parity(w)) {
+        if (syn > 23) return -1;        /* three or more errors       */
+        if (syn)      w ^= 1u << (syn - 1);
+    } else if (syn) {
+        return -1;                      /* two errors                 */
+    }
+
+    return (int)(((w >> 2) & 0x1) |     /* D1       at position 3     */
+                 ((w >> 3) & 0xE) |     /* D2..D4   at 5..7           */
+                 ((w >> 4) & 0x7F0) |   /* D5..D11  at 9..15          */
+                 ((w >> 5) & 0x3F800)); /* D12..D18 at 17..23         */
+}
+
+/* ------------------------------------------------------------------ */
+/* Row parity: decode n (<= 64) display bytes into 7-bit characters   */
+/* and return a mask with bit i set where byte i failed the parity    */
+/* check.  out[i] is undefined for those.                             */
+/* ------------------------------------------------------------------ */
+typedef uint64_t (*ham_par_row_fn)(uint8_t *, const uint8_t *, int);
+
+static inline uint64_t par_row_scalar(uint8_t *out, const uint8_t *in, int n)
+{
+    uint64_t bad = 0;
+    for (int i = 0; i < n; i++) {
+        uint8_t c = par7_tab[in[i]];
+        out[i] = c & 0x7F;
+        bad |= (uint64_t)(c == 0xFF) << i;
+    }
+    return bad;
+}
+
+#ifdef HAM_X86_SIMD
+/* Nibble lookups shared by the PSHUFB kernels: the reversed low      */
+/* nibble lands in the high half, the reversed high nibble in the low */
+/* half, and each nibble's parity is 0xFF (odd) or 0x00 (even).       */
+#define HAM_REV_LO  0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, \
+                    0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0
+#define HAM_REV_HI  0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, \
+                    0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+#define HAM_PAR4    0, -1, -1, 0, -1, 0, 0, -1, -1, 0, 0, -1, 0, -1, -1, 0
+
+/* Sixteen bytes per step; a row that is not a multiple of 16 ends    */
+/* with an overlapping step rather than a scalar tail                 */
+__attribute__((target("ssse3")))
+static inline uint64_t par_row_ssse3(uint8_t *out, const uint8_t *in, int n)
+{
+    const __m128i nib  = _mm_set1_epi8(0x0F);
+    const __m128i low7 = _mm_set1_epi8(0x7F);
+    const __m128i rlo  = _mm_setr_epi8(HAM_REV_LO);
+    const __m128i rhi  = _mm_setr_epi8(HAM_REV_HI);
+    const __m128i par  = _mm_setr_epi8(HAM_PAR4);
+    uint64_t      bad  = 0;
+
+    if (n < 16)
+        return par_row_scalar(out, in, n);
+
+    for (int i = 0; i < n; i += 16) {
+        if (i + 16 > n) i = n - 16;
+        __m128i v  = _mm_loadu_si128((const __m128i *)(const void *)(in + i));
+        __m128i lo = _mm_and_si128(v, nib);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nib);
+        __m128i r  = _mm_or_si128(_mm_shuffle_epi8(rlo, lo),
+                                  _mm_shuffle_epi8(rhi, hi));
+        __m128i p  = _mm_xor_si128(_mm_shuffle_epi8(par, lo),
+                                   _mm_shuffle_epi8(par, hi));
+        _mm_storeu_si128((__m128i *)(void *)(out + i), _mm_and_si128(r, low7));
+        bad |= (uint64_t)(~_mm_movemask_epi8(p) & 0xFFFF) << i;
+    }
+    return bad;
+}
+
+/* Thirty-two bytes per step: a 40-byte row is two overlapping loads  */
+__attribute__((target("avx2")))
+static inline uint64_t par_row_avx2(uint8_t *out, const uint8_t *in, int n)
+{
+    const __m256i nib  = _mm256_set1_epi8(0x0F);
+    const __m256i low7 = _mm256_set1_epi8(0x7F);
+    const __m256i rlo  = _mm256_setr_epi8(HAM_REV_LO, HAM_REV_LO);
+    const __m256i rhi  = _mm256_setr_epi8(HAM_REV_HI, HAM_REV_HI);
+    const __m256i par  = _mm256_setr_epi8(HAM_PAR4, HAM_PAR4);
+    uint64_t      bad  = 0;
+
+    if (n < 32)
+        return par_row_ssse3(out, in, n);
+
+    for (int i = 0; i < n; i += 32) {
+        if (i + 32 > n) i = n - 32;
+        __m256i v  = _mm256_loadu_si256((const __m256i *)(const void *)(in + i));
+        __m256i lo = _mm256_and_si256(v, nib);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nib);
+        __m256i r  = _mm256_or_si256(_mm256_shuffle_epi8(rlo, lo),
+                                     _mm256_shuffle_epi8(rhi, hi));
+        __m256i p  = _mm256_xor_si256(_mm256_shuffle_epi8(par, lo),
+                                      _mm256_shuffle_epi8(par, hi));
+        _mm256_storeu_si256((__m256i *)(void *)(out + i),
+                            _mm256_and_si256(r, low7));
+        bad |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(p) << i;
+    }
+    return bad;
+}
+#endif /* HAM_X86_SIMD */
+
+static ham_par_row_fn ham_par_row = par_row_scalar;
+
+/* ------------------------------------------------------------------ */
+/* Build the tables and pick the widest row kernel the CPU runs       */
+/* ------------------------------------------------------------------ */
+static inline void ham_init(void)
+{
+    uint8_t code[16];
+
+    for (int b = 0; b < 256; b++) {
+        int r = 0;
+        for (int i = 0; i < 8; i++)
+            if (b & (1 << i)) r |= 0x80 >> i;
+        ham_rev8[b] = (uint8_t)r;
+    }
+
+    /* Hamming 8/4 codewords, bits P1 D1 P2 D2 P3 D3 P4 D4            */
+    for (int n = 0; n < 16; n++) {
+        int d1 = n & 1, d2 = (n >> 1) & 1, d3 = (n >> 2) & 1, d4 = n >> 3;
+        int p1 = 1 ^ d1 ^ d3 ^ d4;
+        int p2 = 1 ^ d1 ^ d2 ^ d4;
+        int p3 = 1 ^ d1 ^ d2 ^ d3;
+        int p4 = 1 ^ p1 ^ d1 ^ p2 ^ d2 ^ p3 ^ d3 ^ d4;
+        code[n] = (uint8_t)(p1 | d1 << 1 | p2 << 2 | d2 << 3 |
+                            p3 << 4 | d3 << 5 | p4 << 6 | d4 << 7);
+    }
+
+    for (int b = 0; b < 256; b++) {
+        int r = ham_rev8[b];
+
+        /* Minimum distance is 4: one flipped bit is corrected, two  */
+        /* are detected                                               */
+        ham84_tab[b] = -1;
+        for (int n = 0; n < 16; n++)
+            if (__builtin_popcount(r ^ code[n]) <= 1) ham84_tab[b] = (int8_t)n;
+
+        par7_tab[b] = __builtin_parity(r) ? (uint8_t)(r & 0x7F) : 0xFF;
+
+        /* Position 24 (P6) is covered by the overall parity only     */
+        for (int k = 0; k < 3; k++) {
+            int syn = 0;
+            for (int i = 0; i < 8; i++) {
+                int pos = 8 * k + i + 1;
+                if ((r & (1 << i)) && pos < 24) syn ^= pos;
+            }
+            ham2418_syn[k][b] = (uint8_t)syn;
+        }
+    }
+
+    ham_par_row = par_row_scalar;
+#ifdef HAM_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        ham_par_row = par_row_ssse3;
+    if (__builtin_cpu_supports("avx2"))
+        ham_par_row = par_row_avx2;
+#endif
+}
+
+#endif /* TTXD_HAMMING_H */
@@ -2,17 +2,48 @@
  * ttxd.c  —  DVB Teletext from HDHomeRun → UDP → Node-RED
  *
  * Build:
- *   gcc -O2 -Wall -Wextra -std=c99 -o ttxd ttxd.c $(pkg-config --cflags --libs zvbi)
+ *   gcc -O2 -Wall -Wextra -std=c99 -pthread -o ttxd ttxd.c $(pkg-config --cflags --libs zvbi) -lz
+ *   gcc -O2 -Wall -Wextra -std=c99 -pthread -DTTXD_NO_ZVBI -o ttxd ttxd.c -lz   (native only)
+ *   add -DTTXD_NO_PNG and drop -lz to build without --render
  *
  * Usage:
- *   ttxd <hdhomerun-ip>[:<port>] <channel> <teletext-pid> <udp-port>
+ *   ttxd [options] <hdhomerun-ip>[:<port>] <channel> <teletext-pid> <udp-port> [...]
  *
  * Example:
  *   ttxd 192.168.1.154:5004 1 7013 5555
+ *   ttxd 192.168.1.154 1 7013 5555  192.168.1.154 2 2010 5556
  *
  * Port defaults to 5004 (HDHomeRun streaming port) if omitted.
+ * The four arguments may be repeated to ingest several channels in one
+ * process; every stream is driven from a single epoll loop.
  *
- * Outputs one JSON object per complete teletext page to UDP 127.0.0.1:<port>
+ * Options:
+ *   -u, --io-uring   receive via io_uring multishot recv (Linux >= 6.0)
+ *   -s, --stats=N    log per-stream counters every N seconds
+ *   -n, --native     decode teletext with the built-in EN 300 706 decoder
+ *                    instead of libzvbi (always on with -DTTXD_NO_ZVBI)
+ *   -j, --mag-workers=N
+ *                    assemble pages on N threads by magazine (implies -n)
+ *   -d, --dedupe=N   skip pages whose text has not changed, re-sending
+ *                    each one at least every N seconds (0 = never)
+ *   -D, --delta=N    send changed rows only, with a full snapshot of each
+ *                    page at least every N seconds
+ *   -q, --query=PORT keep the latest copy of every page and answer
+ *                    requests for it on UDP 127.0.0.1:PORT
+ *   -b, --batch=N[,MS]
+ *                    send up to N datagrams per sendmmsg(), waiting at
+ *                    most MS milliseconds (default 2) for a batch to fill
+ *   -T, --ttl=N      TTL / hop limit for multicast destinations
+ *   -I, --mcast-if=IFACE
+ *                    send multicast out of this interface
+ *   -w, --http=[ADDR:]PORT
+ *                    push pages to WebSocket (/ws) and Server-Sent
+ *                    Events (/events) clients
+ *   -r, --render     also serve stored pages as PNG images on
+ *                    /page/NNN.png (needs --http)
+ *
+ * Outputs one JSON object per complete teletext page to UDP 127.0.0.1:<port>,
+ * or to each address of a list such as 5555,192.168.1.20:5555,239.1.1.1:5555
  * Each datagram is a self-contained JSON object terminated with newline.
  *
  * JSON format:
@@ -32,44 +63,482 @@
  * Text is UTF-8.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <net/if.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+/* libzvbi is the reference decoder.  Build with -DTTXD_NO_ZVBI to    */
+/* drop the dependency and use only the native decoder (--native).    */
+#ifndef TTXD_NO_ZVBI
 #include <libzvbi.h>
+#define HAVE_ZVBI 1
+#endif
+
+/* The io_uring receive path talks to the kernel directly (no liburing) */
+/* and needs multishot recv + provided buffer rings: Linux ≥ 6.0       */
+/* headers.  Build with -DTTXD_NO_IO_URING to leave it out entirely.   */
+#ifndef TTXD_NO_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef IORING_RECV_MULTISHOT
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+/* SSE2 is baseline on x86-64; AVX2 is picked at run time if present  */
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "hamming.h"
+#include "ttxd_attr.h"
+#include "ttxd_charset.h"
+#include "ttxd_shm.h"
+#include "ttxd_wire.h"
+
+/* Page images (--render) are deflated with zlib.  Build with         */
+/* -DTTXD_NO_PNG to leave the renderer and the dependency out.         */
+#ifndef TTXD_NO_PNG
+#include "ttxd_render.h"
+#define HAVE_PNG 1
+#endif
 
 /* ------------------------------------------------------------------ */
 #define TS_PACKET_SIZE  188
 #define TS_SYNC_BYTE    0x47
 #define MAX_PES_SIZE    65548   /* 65536 + PES header overhead        */
-#define UDP_MAX_PAYLOAD 8192    /* max JSON datagram size              */
+#define UDP_MAX_PAYLOAD 16384   /* max datagram size; JSON with spans  */
+                                /* for every cell passes 8 KB          */
 #define HTTP_HDR_MAX    8192    /* max bytes to scan for end-of-header */
 #define RECV_BUF_SIZE   65536   /* TCP read buffer                     */
 #define HDHOMERUN_PORT  5004    /* default HDHomeRun streaming port    */
+#define MAX_STREAMS     64      /* channel tuples per process          */
+#define RECONNECT_DELAY 5       /* seconds between connection attempts */
+#define HTTP_TIMEOUT    10      /* seconds allowed for connect+headers */
+#define URING_ENTRIES   128     /* io_uring submission queue size      */
+#define URING_BUF_COUNT 64      /* provided receive buffers (power of 2) */
+#define URING_BUF_SIZE  32768   /* bytes per provided receive buffer   */
+#define TS_FILTER_BATCH 64      /* packets per pre-filter pass         */
+#define TS_FILTER_MAX   4       /* PIDs a stream can pre-filter on     */
+#define TS_RESYNC_COUNT 5       /* sync bytes in a row to regain lock  */
+#define TS_RESYNC_WINDOW (TS_RESYNC_COUNT * TS_PACKET_SIZE)
+#define PSI_MAX_SECTION 1024    /* 3-byte header + section_length max  */
+#define TTX_INDEX_MAX   51      /* 5-byte entries in a 255-byte descriptor */
+#define TTX_INDEX_REPEAT 60     /* seconds between page index repeats  */
+#define PES_FRAG_MAX    64      /* receive-buffer references per PES   */
+#define PES_SPILL_SIZE  4096    /* initial size of a pooled spill buffer */
+#define TTX_ROWS        25      /* rows 0..24 of a teletext page       */
+#define TTX_COLS        40
+#define TTX_PKT_SIZE    42      /* packet address + 40 data bytes      */
+#define MAG_QUEUE_SIZE  1024    /* jobs per magazine worker (power of 2) */
+#define PAGE_ALL_ROWS   ((1u << TTX_ROWS) - 1)
+#define CACHE_PAGES     800     /* page numbers 100..899 per stream    */
+#define CACHE_SUBPAGES  100     /* subpages kept per page, oldest goes */
+#define WS_HDR_ROOM     4       /* WebSocket frame header, payload < 64K */
+#define WEB_CLIENTS_MAX 1024    /* open HTTP/WebSocket connections     */
+#define WEB_QUEUE_MAX   64      /* frames queued per WebSocket client  */
+#define WEB_IN_MAX      4096    /* request head, or one client frame   */
+#define PIPE_RING_SIZE  64      /* slots per pipeline ring (power of 2) */
+#define PIPE_RX_CHUNKS  32      /* receive buffers in flight to demux, */
+                                /* below URING_BUF_COUNT               */
+#define PIPE_OUT_MSGS   64      /* datagrams in flight to the output   */
+#define UDP_BATCH_MAX   64      /* datagrams per sendmmsg()            */
+#define UDP_BATCH_BYTES 131072  /* copy arena for one batch            */
+#define UDP_DEST_MAX    8       /* output addresses per stream         */
+
+/* ------------------------------------------------------------------ */
+/* Every fd registered with epoll carries one of these in data.ptr,   */
+/* embedded as the first member of the object that owns the fd.       */
+/* ------------------------------------------------------------------ */
+struct ev_handler {
+    void (*fn)(struct ev_handler *h, uint32_t events);
+};
+
+/* One UDP output address: IPv4 or IPv6, unicast or multicast        */
+struct udp_dest {
+    struct sockaddr_storage addr;
+    socklen_t           len;
+};
+
+static int udp_dest_port(const struct udp_dest *d)
+{
+    return d->addr.ss_family == AF_INET6
+        ? ntohs(((const struct sockaddr_in6 *)&d->addr)->sin6_port)
+        : ntohs(((const struct sockaddr_in *)&d->addr)->sin_port);
+}
+
+/* ------------------------------------------------------------------ */
+/* Per-stream state.  One of these exists for every                    */
+/* (host, channel, pid, udp-port) tuple on the command line.          */
+/* ------------------------------------------------------------------ */
+enum stream_state {
+    ST_IDLE,            /* waiting for deadline to reconnect           */
+    ST_CONNECTING,      /* non-blocking connect() in progress          */
+    ST_HEADERS,         /* request sent, reading HTTP response headers */
+    ST_STREAMING        /* receiving MPEG-TS                           */
+};
+
+/* Counters reported by --stats, cumulative since start-up            */
+struct ttx_stats {
+    uint64_t            rx_bytes;       /* TS bytes received           */
+    uint64_t            resyncs;        /* times TS alignment regained */
+    uint64_t            resync_bytes;   /* bytes skipped while hunting */
+    uint64_t            cc_errors;      /* continuity counter gaps     */
+    uint64_t            cc_dups;        /* duplicate packets discarded */
+    uint64_t            pes_dropped;    /* partial PES lost to CC gaps */
+    uint64_t            pes_copied;     /* PES bytes spilled across reads */
+    uint64_t            ham_errors;     /* native: uncorrectable addresses */
+    uint64_t            pages_unchanged;/* output thread: --dedupe skips */
+};
+
+/* PAT/PMT section reassembly buffer                                  */
+struct psi_buf {
+    uint8_t             data[PSI_MAX_SECTION];
+    int                 len;
+    int                 started;        /* 0 = wait for next PUSI      */
+    int                 cc;             /* last continuity counter, -1 */
+};
+
+/* A run of PES payload still sitting in the receive buffer           */
+struct pes_frag {
+    const uint8_t      *p;
+    int                 len;
+};
+
+/* Linear copy of a PES that outlived the buffer it arrived in        */
+struct pes_spill {
+    struct pes_spill   *next;           /* free list link              */
+    int                 cap;
+    int                 len;
+    uint8_t             data[];
+};
+
+/* One page announced by the teletext_descriptor                      */
+struct ttx_index_entry {
+    char                lang[4];        /* ISO 639-2, NUL terminated   */
+    int                 type;           /* teletext_type, see EN 300 468 */
+    int                 page;           /* 100..899                    */
+};
+
+/* A decoded page, as handed to the output by either decoder         */
+struct ttx_page {
+    int                 pgno;           /* 100..899                    */
+    int                 subno;          /* 0 = no subpages             */
+    unsigned int        text[TTX_ROWS][TTX_COLS];  /* Unicode; mosaics */
+                                        /* in private use U+EE00..    */
+    uint16_t            attr[TTX_ROWS][TTX_COLS];  /* TTXD_ATTR_*     */
+    int64_t             pts;            /* 90 kHz, of the PES that     */
+                                        /* completed it; -1 = none     */
+};
+
+/* Native decoder: the page being assembled in one magazine           */
+struct ttx_mag {
+    struct ttx_page     page;
+    int                 active;         /* header seen, taking rows    */
+    int                 national;       /* C12–C14 national option     */
+    int64_t             pts;            /* PES of the latest packet    */
+};
+
+struct ttx_decoder {
+    struct ttx_mag      mag[8];         /* magazine 8 is index 0       */
+};
+
+struct ttx_stream {
+    struct ev_handler   ev;             /* must be first               */
+    char                host[64];
+    int                 port;
+    int                 channel;
+    int                 pid;            /* teletext PID, 0 = not known */
+    int                 pid_fixed;      /* given on the command line   */
+    struct udp_dest     dest[UDP_DEST_MAX]; /* UDP output, dest[0] names */
+    int                 ndest;          /* the stream in queries       */
+
+    /* Connection: receive thread only */
+    int                 fd;
+    enum stream_state   state;
+    time_t              deadline;       /* retry time or I/O timeout   */
+    uint32_t            gen;            /* bumped on every connect     */
+    int                 rx_dirty;       /* data queued since last reset */
+
+    /* HTTP response header buffer, only allocated while connecting */
+    char               *hdr;
+    int                 hdr_len;
+
+    /* Everything below belongs to the demux thread */
+    int                 decoding;       /* decoder initialised         */
+
+    /* TS alignment carry buffer — spans recv() call boundaries, and */
+    /* holds the search window while hunting for sync               */
+    uint8_t             carry[TS_RESYNC_WINDOW];
+    int                 carry_len;
+    int                 synced;         /* 0 = hunting for sync bytes  */
+    uint64_t            hunt_skipped;   /* bytes dropped this hunt     */
+
+    /* Header words the PID pre-filter passes, see ts_hdr_key() */
+    uint32_t            filter_keys[TS_FILTER_MAX];
+    int                 nfilter;
+    uint32_t            filter_gen;     /* bumped when keys change     */
+
+    /* PSI tables used to find the teletext PID */
+    struct psi_buf      pat;
+    struct psi_buf      pmt;
+    int                 pmt_pid;        /* 0 = PAT not seen yet        */
+    int                 pat_version;    /* -1 = none parsed            */
+    int                 pmt_version;
+
+    /* Pages announced in the PMT teletext_descriptor */
+    struct ttx_index_entry index[TTX_INDEX_MAX];
+    int                 nindex;
+    time_t              index_next;     /* next periodic re-publish    */
+
+    /* PES accumulation: references into the receive buffer, plus a  */
+    /* spill copy of what came from earlier reads                     */
+    struct pes_frag     frags[PES_FRAG_MAX];
+    int                 nfrag;
+    struct pes_spill   *spill;          /* NULL unless PES spans reads */
+    int                 pes_len;        /* spill + fragments           */
+    int                 pes_target;     /* expected total PES size, 0 = unbounded */
+    int                 pes_cc;         /* last continuity counter, -1 */
+    int                 pes_wait_pus;   /* skip payload until next PUSI */
+    int64_t             pts;            /* of the PES being decoded, -1 */
+
+#ifdef HAVE_ZVBI
+    vbi_dvb_demux      *demux;
+    vbi_decoder        *dec;
+#endif
+    struct ttx_decoder *ttx;            /* native decoder, --native    */
+
+    struct ttx_stats    stats;
+};
 
 /* ------------------------------------------------------------------ */
-static vbi_dvb_demux     *g_demux    = NULL;
-static vbi_decoder       *g_dec      = NULL;
+static struct ttx_stream  g_streams[MAX_STREAMS];
+static int                g_nstreams = 0;
+static int                g_epfd     = -1;
 static int                g_udp_fd   = -1;
-static struct sockaddr_in g_dest;
-static int                g_pid      = 0;
+static int                g_udp6_fd  = -1;    /* only with IPv6 output */
+static int                g_mcast_ttl = -1;   /* --ttl, -1 = default   */
+static unsigned           g_mcast_if  = 0;    /* --mcast-if index      */
 static volatile int       g_running  = 1;
+static int                g_use_uring = 0;
+#ifdef HAVE_ZVBI
+static int                g_native    = 0;
+#else
+static int                g_native    = 1;
+#endif
+static int                g_stats_interval = 0;    /* seconds, 0 = off */
+static int                g_dedupe    = 0;
+static int                g_heartbeat = 0;    /* --dedupe re-send, s */
+static int                g_delta     = 0;    /* --delta snapshot, s */
+static int                g_binary    = 0;    /* --format=binary     */
+static int                g_attrs     = 0;    /* --attributes        */
+static int                g_sextants  = 0;    /* --sextants          */
+static int                g_render    = 0;    /* --render            */
+static int                g_query_fd  = -1;   /* --query socket      */
+static int                g_cache_on  = 0;    /* --query or --http   */
+static int                g_out_epfd  = -1;   /* output thread sockets */
+static struct ttxd_shm_header *g_shm  = NULL; /* --shm page ring       */
+static char               g_shm_name[256];
+static struct pes_spill  *g_spill_free = NULL;    /* idle spill buffers */
+
+/* ------------------------------------------------------------------ */
+/* Pipeline                                                            */
+/*                                                                     */
+/*   receive (main) ──rx──▶ demux/decode ──out──▶ output               */
+/*           ◀──rx_free──              ◀──out_free──                   */
+/*                                                                     */
+/* The main thread runs the epoll loop: connections, recv() or        */
+/* io_uring.  Received bytes go to the demux thread in an rx_chunk,   */
+/* which owns the buffer until the demux hands it back on rx_free.    */
+/* Decoded pages and index messages go to the output thread in an     */
+/* out_msg, which it formats, sends and returns on out_free.  Nothing */
+/* is copied between stages; only pointers move.                      */
+/*                                                                     */
+/* Each ring has exactly one producer and one consumer thread and is  */
+/* lock-free.  Rings are larger than the pools that feed them, so a   */
+/* push never fails; back-pressure comes from the pools instead.  A   */
+/* stage that runs out of chunks or messages sleeps until its         */
+/* consumer returns one, which in turn stops recv() and lets TCP      */
+/* flow control slow the tuner down.                                  */
+/* ------------------------------------------------------------------ */
+struct spsc_ring {
+    /* Producer side */
+    unsigned            head;
+    unsigned            high_water;     /* most slots ever in use      */
+
+    /* Consumer side, on its own cache line */
+    unsigned            tail __attribute__((aligned(64)));
+    int                 waiting;        /* consumer about to sleep     */
+
+    int                 efd __attribute__((aligned(64)));  /* wake-up  */
+    const char         *name;
+    void               *slot[PIPE_RING_SIZE];
+};
+
+enum { RX_DATA, RX_RESET };
+
+/* Received bytes on their way to the demux                           */
+struct rx_chunk {
+    struct rx_chunk    *next;           /* idle list, receive thread   */
+    struct ttx_stream  *s;
+    int                 op;             /* RX_DATA or RX_RESET         */
+    int                 len;
+    const uint8_t      *data;
+    int                 bid;            /* io_uring buffer, -1 = own   */
+    uint8_t            *own;            /* RECV_BUF_SIZE, on first use */
+};
+
+/* One datagram on its way to the output: a page still to be          */
+/* formatted (len == 0), or ready-made bytes                           */
+struct out_msg {
+    struct out_msg     *next;           /* idle list, demux thread     */
+    struct ttx_stream  *s;
+    int                 len;
+    union {
+        struct ttx_page page;
+        char            raw[UDP_MAX_PAYLOAD];
+    } u;
+};
+
+struct pipeline {
+    struct spsc_ring    rx, rx_free, out, out_free;
+    pthread_t           demux, output;
+    int                 stop;           /* main → demux: drain and exit */
+    int                 out_stop;       /* demux → output: likewise    */
+
+    struct rx_chunk    *rx_idle;        /* receive thread only         */
+    int                 rx_count;
+    struct out_msg     *out_idle;       /* demux thread only           */
+    int                 out_count;
+};
+
+static struct pipeline g_pipe;
+
+static int spsc_init(struct spsc_ring *r, const char *name)
+{
+    r->name = name;
+    r->efd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->efd < 0) { perror("ttxd: eventfd"); return 0; }
+    return 1;
+}
+
+/* Producer: append one pointer and wake the consumer if it sleeps    */
+static void spsc_push(struct spsc_ring *r, void *p)
+{
+    unsigned h = r->head;
+    unsigned t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+    r->slot[h & (PIPE_RING_SIZE - 1)] = p;
+    if (h + 1 - t > __atomic_load_n(&r->high_water, __ATOMIC_RELAXED))
+        __atomic_store_n(&r->high_water, h + 1 - t, __ATOMIC_RELAXED);
+
+    /* Sequentially consistent, as in spsc_arm(): either the consumer */
+    /* sees the new head, or this sees its waiting flag                */
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&r->waiting, 0, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        ssize_t  n   = write(r->efd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+/* Consumer: take the oldest pointer, NULL if the ring is empty       */
+static void *spsc_pop(struct spsc_ring *r)
+{
+    unsigned t = r->tail;
+
+    if (t == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+        return NULL;
+    void *p = r->slot[t & (PIPE_RING_SIZE - 1)];
+    __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+    return p;
+}
 
-/* TS alignment carry buffer — spans recv() call boundaries */
-static uint8_t  g_carry[TS_PACKET_SIZE];
-static int      g_carry_len = 0;
+/* Consumer: announce that it is about to sleep on r->efd.  Returns 0 */
+/* (and does not announce) if something arrived in the meantime.      */
+static int spsc_arm(struct spsc_ring *r)
+{
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+    if (r->tail != __atomic_load_n(&r->head, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+/* Consumer: woken up (or timed out); clear the eventfd               */
+static void spsc_disarm(struct spsc_ring *r)
+{
+    uint64_t cnt;
+    ssize_t  n = read(r->efd, &cnt, sizeof(cnt));
+    (void)n;
+    __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+}
 
-/* PES accumulation */
-static uint8_t  g_pes[MAX_PES_SIZE];
-static int      g_pes_len    = 0;
-static int      g_pes_target = 0;   /* expected total PES size, 0 = unbounded */
+/* Consumer: sleep until r has data, fd2 is readable or the timeout   */
+/* expires                                                             */
+static void spsc_sleep(struct spsc_ring *r, int fd2, int timeout_ms)
+{
+    struct pollfd pfd[2] = { { r->efd, POLLIN, 0 }, { fd2, POLLIN, 0 } };
+
+    if (spsc_arm(r))
+        poll(pfd, 2, timeout_ms);
+    spsc_disarm(r);
+}
+
+/* Demux thread: an idle message, waiting for the output thread to    */
+/* return one if all are in flight.  NULL only if none can be made.   */
+static struct out_msg *out_msg_get(void)
+{
+    for (;;) {
+        struct out_msg *m;
+
+        if (!g_pipe.out_idle) {
+            while ((m = spsc_pop(&g_pipe.out_free)) != NULL) {
+                m->next = g_pipe.out_idle;
+                g_pipe.out_idle = m;
+            }
+        }
+        if ((m = g_pipe.out_idle) != NULL) {
+            g_pipe.out_idle = m->next;
+            return m;
+        }
+        if (g_pipe.out_count < PIPE_OUT_MSGS) {
+            if ((m = malloc(sizeof(*m))) != NULL) {
+                g_pipe.out_count++;
+                return m;
+            }
+            if (g_pipe.out_count == 0) {
+                fprintf(stderr, "ttxd: output message allocation failed\n");
+                return NULL;
+            }
+        }
+        spsc_sleep(&g_pipe.out_free, -1, 1000);
+    }
+}
 
 /* ------------------------------------------------------------------ */
 static void signal_handler(int sig)
@@ -78,6 +547,21 @@ static void signal_handler(int sig)
     g_running = 0;
 }
 
+/* ------------------------------------------------------------------ */
+/* Log a message prefixed with the stream it concerns                  */
+static void stream_log(const struct ttx_stream *s, const char *fmt, ...)
+{
+    char    msg[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    fprintf(stderr, "ttxd: [%s:%d/v%d] %s\n",
+            s->host, s->port, s->channel, msg);
+}
+
 /* ------------------------------------------------------------------ */
 /* Encode a Unicode codepoint to UTF-8.  Returns bytes written.       */
 static int utf8_encode(char *buf, unsigned int cp)
@@ -89,11 +573,17 @@ static int utf8_encode(char *buf, unsigned int cp)
         buf[0] = (char)(0xC0 | (cp >> 6));
         buf[1] = (char)(0x80 | (cp & 0x3F));
         return 2;
-    } else {
+    } else if (cp < 0x10000) {
         buf[0] = (char)(0xE0 | (cp >>  12));
         buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
         buf[2] = (char)(0x80 | (cp & 0x3F));
         return 3;
+    } else {
+        buf[0] = (char)(0xF0 | (cp >>  18));
+        buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        buf[3] = (char)(0x80 | (cp & 0x3F));
+        return 4;
     }
 }
 
@@ -125,496 +615,4462 @@ static int json_escape(char *dst, int dst_size,
 }
 
 /* ------------------------------------------------------------------ */
-/* Send a null-terminated string as a single UDP datagram             */
-static void udp_send(const char *s, int len)
+/* UDP output, output thread only.                                     */
+/*                                                                     */
+/* A burst (a reconnect, a magazine of subpages) completes dozens of  */
+/* pages within milliseconds.  With --batch, datagrams are copied     */
+/* into an arena and leave together in one sendmmsg() once N have     */
+/* collected or the oldest has waited the batch window.                */
+/*                                                                     */
+/* A page for a stream with several destinations is copied once;      */
+/* every destination gets its own message pointing at that copy.      */
+/* ------------------------------------------------------------------ */
+struct udp_batch {
+    int                 max;            /* --batch N, 0 = off          */
+    int                 window_ms;
+    int                 n;
+    int                 used;           /* arena bytes                 */
+    struct timespec     first;          /* when the oldest was queued  */
+    struct mmsghdr      msg[UDP_BATCH_MAX];
+    struct iovec        iov[UDP_BATCH_MAX];
+    int                 fd[UDP_BATCH_MAX];  /* socket for msg[i]       */
+    char                arena[UDP_BATCH_BYTES];
+
+    /* --stats, read by the demux thread */
+    uint64_t            calls;          /* sendmmsg() calls            */
+    uint64_t            sent;           /* datagrams they carried      */
+    unsigned            largest;
+};
+
+static struct udp_batch g_batch;
+
+static int udp_fd(const struct udp_dest *d)
 {
-    ssize_t sent = sendto(g_udp_fd, s, (size_t)len, 0,
-                          (struct sockaddr *)&g_dest, sizeof(g_dest));
-    if (sent < 0)
-        fprintf(stderr, "ttxd: udp sendto: %s\n", strerror(errno));
+    return d->addr.ss_family == AF_INET6 ? g_udp6_fd : g_udp_fd;
 }
 
-/* ------------------------------------------------------------------ */
-/* VBI event callback — fires when a complete TTX page is decoded     */
-static void ttx_event_cb(vbi_event *ev, void *user_data)
+static void udp_flush(void)
 {
-    (void)user_data;
-    if (ev->type != VBI_EVENT_TTX_PAGE) return;
+    int off = 0;
 
-    int pgno  = ev->ev.ttx_page.pgno;
-    int subno = ev->ev.ttx_page.subno & 0xFFFF;
+    /* One call per run of messages for the same socket               */
+    while (off < g_batch.n) {
+        int run = 1;
+        while (off + run < g_batch.n &&
+               g_batch.fd[off + run] == g_batch.fd[off])
+            run++;
 
-    vbi_page page;
-    if (!vbi_fetch_vt_page(g_dec, &page, pgno, subno,
-                           VBI_WST_LEVEL_1p5, 25, TRUE))
+        int r = sendmmsg(g_batch.fd[off], g_batch.msg + off,
+                         (unsigned)run, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ttxd: udp sendmmsg: %s\n", strerror(errno));
+            off++;                      /* drop it, try the next      */
+            continue;
+        }
+        __atomic_fetch_add(&g_batch.calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_batch.sent, (uint64_t)r, __ATOMIC_RELAXED);
+        if ((unsigned)r > g_batch.largest)
+            __atomic_store_n(&g_batch.largest, (unsigned)r, __ATOMIC_RELAXED);
+        off += r;
+    }
+    g_batch.n    = 0;
+    g_batch.used = 0;
+}
+
+/* Flush once the oldest datagram has waited out the window.  Returns */
+/* the milliseconds left until then, 1000 with nothing queued.         */
+static int udp_batch_timer(void)
+{
+    struct timespec now;
+
+    if (!g_batch.n)
+        return 1000;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long waited = (now.tv_sec - g_batch.first.tv_sec) * 1000 +
+                  (now.tv_nsec - g_batch.first.tv_nsec) / 1000000;
+    if (waited >= g_batch.window_ms) {
+        udp_flush();
+        return 1000;
+    }
+    return (int)(g_batch.window_ms - waited);
+}
+
+/* Send buf as a single UDP datagram to each of the stream's          */
+/* destinations, now or as part of a batch                             */
+static void udp_send(const struct ttx_stream *s, const char *buf, int len)
+{
+    if (!g_batch.max) {
+        for (int i = 0; i < s->ndest; i++) {
+            const struct udp_dest *d = &s->dest[i];
+            ssize_t sent = sendto(udp_fd(d), buf, (size_t)len, 0,
+                                  (const struct sockaddr *)&d->addr, d->len);
+            if (sent < 0)
+                fprintf(stderr, "ttxd: udp sendto: %s\n", strerror(errno));
+        }
         return;
+    }
+
+    if (g_batch.n + s->ndest > g_batch.max ||
+        g_batch.used + len > UDP_BATCH_BYTES)
+        udp_flush();
+    if (!g_batch.n)
+        clock_gettime(CLOCK_MONOTONIC, &g_batch.first);
+
+    struct iovec *v = &g_batch.iov[g_batch.n];
+
+    memcpy(g_batch.arena + g_batch.used, buf, (size_t)len);
+    v->iov_base = g_batch.arena + g_batch.used;
+    v->iov_len  = (size_t)len;
+    g_batch.used += len;
+
+    for (int i = 0; i < s->ndest; i++) {
+        const struct udp_dest *d = &s->dest[i];
+        struct mmsghdr        *m = &g_batch.msg[g_batch.n];
+
+        memset(m, 0, sizeof(*m));
+        m->msg_hdr.msg_name    = (void *)&d->addr;
+        m->msg_hdr.msg_namelen = d->len;
+        m->msg_hdr.msg_iov     = v;
+        m->msg_hdr.msg_iovlen  = 1;
+        g_batch.fd[g_batch.n++] = udp_fd(d);
+    }
 
-    /* --- Build JSON ------------------------------------------------ */
-    static char   buf[UDP_MAX_PAYLOAD];
+    if (g_batch.n >= g_batch.max)
+        udp_flush();
+}
+
+/* ------------------------------------------------------------------ */
+/* BCD page or subpage number to decimal, -1 if a digit is A–F        */
+static int bcd_to_dec(int bcd)
+{
+    int dec = 0, mul = 1;
+    for (; bcd > 0; bcd >>= 4, mul *= 10) {
+        if ((bcd & 0xF) > 9) return -1;
+        dec += (bcd & 0xF) * mul;
+    }
+    return dec;
+}
+
+/* ------------------------------------------------------------------ */
+/* Block mosaics as Unicode sextants (--sextants)                      */
+/*                                                                     */
+/* A G1 mosaic character has bit 5 set and its six cells in the other */
+/* bits: 0x01 top left, 0x02 top right, 0x04 middle left, 0x08 middle */
+/* right, 0x10 bottom left, 0x40 bottom right.  Packed into six bits  */
+/* in that order, the pattern counts through the "Symbols for Legacy  */
+/* Computing" sextants U+1FB00..1FB3B, which leave out the four that  */
+/* already exist as blocks: none, left half, right half and full.     */
+/* Unicode 13 has no separated forms, so those map to the same.       */
+/* ------------------------------------------------------------------ */
+static unsigned int g_sextant[128];     /* by character, 0x20 if none  */
+
+static void sextant_init(void)
+{
+    for (int c = 0; c < 128; c++) {
+        int p = (c & 0x1F) | (c & 0x40) >> 1;
+
+        if (!(c & 0x20))  g_sextant[c] = 0x20;      /* not a mosaic   */
+        else if (p == 0)  g_sextant[c] = 0x20;
+        else if (p == 21) g_sextant[c] = 0x258C;    /* ▌              */
+        else if (p == 42) g_sextant[c] = 0x2590;    /* ▐              */
+        else if (p == 63) g_sextant[c] = 0x2588;    /* █              */
+        else g_sextant[c] = 0x1FB00u + (unsigned)(p - 1 - (p > 21) - (p > 42));
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Replace control chars, mosaic chars (>= 0xEE00) and soft-hyphen    */
+/* with plain space: what a page cell looks like in the output.  With */
+/* --sextants, mosaics (U+EE20.., separated U+EF20..) are looked up   */
+/* in g_sextant[] instead.                                            */
+static unsigned int page_char(unsigned int cp)
+{
+    if (g_sextants && cp >= 0xEE00 && cp < 0xF000)
+        return g_sextant[cp & 0x7F];
+    return (cp < 0x20 || cp == 0x00AD || cp >= 0xEE00) ? 0x20 : cp;
+}
+
+/* One row as UTF-8, trailing spaces trimmed.  Returns the length;    */
+/* buf must hold 4 × TTX_COLS bytes.                                   */
+static int page_row_utf8(char *buf, const struct ttx_page *pg, int row)
+{
+    int len = 0;
+
+    for (int col = 0; col < TTX_COLS; col++)
+        len += utf8_encode(buf + len, page_char(pg->text[row][col]));
+    while (len > 0 && buf[len - 1] == ' ') len--;
+    return len;
+}
+
+/* Attribute spans of a row (--attributes): the columns where the     */
+/* attribute word changes, starting from TTXD_ATTR_DEFAULT, and the   */
+/* word from there on.  A plain row has none.  Returns the count.     */
+static int page_row_spans(uint8_t *col, uint16_t *attr,
+                          const struct ttx_page *pg, int row)
+{
+    uint16_t prev = TTXD_ATTR_DEFAULT;
+    int      n    = 0;
+
+    for (int c = 0; c < TTX_COLS; c++) {
+        if (pg->attr[row][c] == prev)
+            continue;
+        prev      = pg->attr[row][c];
+        col[n]    = (uint8_t)c;
+        attr[n++] = prev;
+    }
+    return n;
+}
+
+/* ------------------------------------------------------------------ */
+/* Serialise a page to JSON (output thread).  rows selects what goes  */
+/* out: PAGE_ALL_ROWS gives the full "lines" array, any other mask a  */
+/* "delta" object holding just those rows (--delta).  seq < 0 leaves  */
+/* the sequence number out.  Returns the length; buf must hold        */
+/* UDP_MAX_PAYLOAD bytes.                                              */
+static int page_format(char *buf, const struct ttx_page *pg, long seq,
+                       uint32_t rows)
+{
     static char   row_utf8[256];
     static char   row_esc[512];
+    const int     size = UDP_MAX_PAYLOAD;
+    const int     full = rows == PAGE_ALL_ROWS;
     int           pos = 0;
+    int           first = 1;
 
-    pos += snprintf(buf + pos, sizeof(buf) - pos,
-                    "{\"page\":%d,\"subpage\":%d,\"ts\":%ld,\"lines\":[",
-                    pgno, subno, (long)time(NULL));
+    pos += snprintf(buf + pos, size - pos,
+                    "{\"page\":%d,\"subpage\":%d,\"ts\":%ld",
+                    pg->pgno, pg->subno, (long)time(NULL));
+    if (seq >= 0)
+        pos += snprintf(buf + pos, size - pos, ",\"seq\":%ld", seq);
+    pos += snprintf(buf + pos, size - pos, full ? ",\"lines\":[" : ",\"delta\":{");
 
-    int cols = page.columns;  /* usually 40 */
-    int rows = page.rows;     /* usually 25 */
-
-    for (int row = 0; row < rows; row++) {
-        int rlen = 0;
-        for (int col = 0; col < cols; col++) {
-            unsigned int cp = page.text[row * cols + col].unicode;
-
-            /* Replace control chars, mosaic chars (>= 0xEE00) and   */
-            /* soft-hyphen with plain space                            */
-            if (cp < 0x20 || cp == 0x00AD || cp >= 0xEE00)
-                cp = 0x20;
+    for (int row = 0; row < TTX_ROWS; row++) {
+        if (!(rows >> row & 1))
+            continue;
 
-            if (rlen < (int)sizeof(row_utf8) - 4)
-                rlen += utf8_encode(row_utf8 + rlen, cp);
-        }
-        /* Trim trailing spaces */
-        while (rlen > 0 && row_utf8[rlen - 1] == ' ') rlen--;
+        int rlen = page_row_utf8(row_utf8, pg, row);
         row_utf8[rlen] = '\0';
 
-        if (row > 0 && pos < (int)sizeof(buf) - 2)
+        if (!first && pos < size - 2)
             buf[pos++] = ',';
+        first = 0;
 
-        if (pos < (int)sizeof(buf) - 4)
+        if (!full && pos < size - 8)
+            pos += snprintf(buf + pos, size - pos, "\"%d\":", row);
+
+        if (pos < size - 4)
             buf[pos++] = '"';
 
         int elen = json_escape(row_esc, sizeof(row_esc), row_utf8, rlen);
-        if (pos + elen < (int)sizeof(buf) - 4) {
+        if (pos + elen < size - 4) {
             memcpy(buf + pos, row_esc, elen);
             pos += elen;
         }
 
-        if (pos < (int)sizeof(buf) - 2)
+        if (pos < size - 2)
             buf[pos++] = '"';
     }
 
-    if (pos < (int)sizeof(buf) - 4)
-        pos += snprintf(buf + pos, sizeof(buf) - pos, "]}\n");
+    if (pos < size - 2)
+        buf[pos++] = full ? ']' : '}';
+
+    /* "attrs":{"row":[[col,attr],...],...} for the rows sent that   */
+    /* have spans; without any, the key is left out.  Each piece goes */
+    /* in only if the brackets and the closing "}\n" still fit after  */
+    /* it; spans beyond that are dropped.                              */
+    if (g_attrs) {
+        const int room = size - 5;
+        char      piece[24];
+        int       any = 0, full_up = 0;
+
+        for (int row = 0; row < TTX_ROWS && !full_up; row++) {
+            uint8_t  col[TTX_COLS];
+            uint16_t attr[TTX_COLS];
+            int      n, plen;
+
+            if (!(rows >> row & 1) || !(n = page_row_spans(col, attr, pg, row)))
+                continue;
+            plen = snprintf(piece, sizeof(piece), "%s\"%d\":[",
+                            any ? "," : ",\"attrs\":{", row);
+            if (pos + plen > room)
+                break;
+            memcpy(buf + pos, piece, (size_t)plen);
+            pos += plen;
+            for (int i = 0; i < n; i++) {
+                plen = snprintf(piece, sizeof(piece), "%s[%d,%d]",
+                                i ? "," : "", col[i], attr[i]);
+                if (pos + plen > room) {
+                    full_up = 1;
+                    break;
+                }
+                memcpy(buf + pos, piece, (size_t)plen);
+                pos += plen;
+            }
+            buf[pos++] = ']';
+            any = 1;
+        }
+        if (any)
+            buf[pos++] = '}';
+    }
+
+    if (pos < size - 2)
+        pos += snprintf(buf + pos, size - pos, "}\n");
 
     buf[pos] = '\0';
+    return pos;
+}
 
-    vbi_unref_page(&page);
-    udp_send(buf, pos);
+/* Little-endian store of the low n bytes of v                        */
+static void put_le(char *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++, v >>= 8)
+        p[i] = (char)(v & 0xFF);
 }
 
 /* ------------------------------------------------------------------ */
-/* Feed PES data payload (past the PES header) into libzvbi           */
-static void feed_pes_data(const uint8_t *data, int len)
+/* Serialise a page as a binary datagram (--format=binary), laid out  */
+/* as in ttxd_wire.h.  Same arguments as page_format(); at most 32 +  */
+/* 25 × (161 + 121) bytes with spans, well within UDP_MAX_PAYLOAD.    */
+static int page_format_bin(char *buf, const struct ttx_page *pg, long seq,
+                           uint32_t rows)
 {
-    const uint8_t  *p   = data;
-    unsigned int    rem = (unsigned int)len;
+    int pos = TTXD_WIRE_HDR_SIZE;
 
-    while (rem > 0) {
-        vbi_sliced   sliced[64];
-        int64_t      pts     = 0;
+    buf[0] = TTXD_WIRE_MAGIC0;
+    buf[1] = TTXD_WIRE_MAGIC1;
+    buf[2] = TTXD_WIRE_VERSION;
+    buf[3] = (char)((rows != PAGE_ALL_ROWS ? TTXD_WIRE_DELTA : 0) |
+                    (seq >= 0     ? TTXD_WIRE_SEQ : 0) |
+                    (pg->pts >= 0 ? TTXD_WIRE_PTS : 0) |
+                    (g_attrs      ? TTXD_WIRE_ATTRS : 0));
+    put_le(buf + 4,  (uint64_t)pg->pgno, 2);
+    put_le(buf + 6,  (uint64_t)pg->subno, 2);
+    put_le(buf + 8,  rows, 4);
+    put_le(buf + 12, seq >= 0 ? (uint64_t)seq : 0, 4);
+    put_le(buf + 16, pg->pts >= 0 ? (uint64_t)pg->pts : 0, 8);
+    put_le(buf + 24, (uint64_t)time(NULL), 8);
 
-        unsigned int lines = vbi_dvb_demux_cor(g_demux,
-                                               sliced, 64,
-                                               &pts,
-                                               &p, &rem);
-        if (lines > 0)
-            vbi_decode(g_dec, sliced, (int)lines,
-                       (double)pts / 90000.0);
+    for (int row = 0; row < TTX_ROWS; row++) {
+        if (!(rows >> row & 1))
+            continue;
+        int len = page_row_utf8(buf + pos + 1, pg, row);
+        buf[pos] = (char)len;
+        pos += 1 + len;
 
-        /* If no lines were produced and rem didn't shrink, break     */
-        if (lines == 0 && rem == (unsigned int)(p - data + rem))
-            break;
+        if (g_attrs) {
+            uint8_t  col[TTX_COLS];
+            uint16_t attr[TTX_COLS];
+            int      n = page_row_spans(col, attr, pg, row);
+
+            buf[pos++] = (char)n;
+            for (int i = 0; i < n; i++, pos += 3) {
+                buf[pos] = (char)col[i];
+                put_le(buf + pos + 1, attr[i], 2);
+            }
+        }
     }
+    return pos;
 }
 
 /* ------------------------------------------------------------------ */
-/* Parse PES header and pass the data payload to feed_pes_data        */
+/* Page store (--query), output thread only.                          */
 /*                                                                     */
-/* PES header layout (ISO 13818-1 §2.4.3.7):                         */
-/*   0..2  : start code 0x00 0x00 0x01                                */
-/*   3     : stream_id                                                 */
-/*   4..5  : PES_packet_length (0 = unbounded for video/audio)        */
-/*   6     : '10' + flags                                              */
-/*   7     : flags                                                     */
-/*   8     : PES_header_data_length (N)                               */
-/*   9..9+N: optional fields (PTS, DTS, ...)                          */
-/*   9+N.. : payload (for teletext: data_identifier + data units)     */
+/* Keeps the latest full snapshot of every subpage, ready to send, so */
+/* a consumer that (re)starts can ask for a page instead of waiting a */
+/* carousel cycle for it.  Each stream has one slot per page number,  */
+/* indexed by magazine × 100 + page, allocated with its first page.   */
+/* A slot holds its subpages sorted by number; past CACHE_SUBPAGES    */
+/* the one stored longest ago makes room.                              */
+/*                                                                     */
+/* Snapshots are kept as refcounted messages with room in front for a */
+/* WebSocket frame header, so the store, UDP replies and every        */
+/* WebSocket client (--http) share one copy of each.                  */
 /* ------------------------------------------------------------------ */
-static void dispatch_pes(void)
+struct ws_msg {
+    int                 refs;
+    int                 len;            /* payload bytes               */
+    char                data[];         /* WS_HDR_ROOM, then payload   */
+};
+
+/* A message holding one complete frame of the given opcode           */
+static struct ws_msg *ws_msg_new(int opcode, const char *payload, int len)
 {
-    if (g_pes_len < 9)   return;
-    if (g_pes[0] != 0x00 || g_pes[1] != 0x00 || g_pes[2] != 0x01)
-        return;                         /* missing start code         */
+    struct ws_msg *m = malloc(sizeof(*m) + WS_HDR_ROOM + (size_t)len);
+    if (!m) return NULL;
 
-    int hdr_data_len = g_pes[8];
-    int data_start   = 9 + hdr_data_len;
+    m->refs = 1;
+    m->len  = len;
+    if (len < 126) {
+        m->data[2] = (char)(0x80 | opcode);
+        m->data[3] = (char)len;
+    } else {
+        m->data[0] = (char)(0x80 | opcode);
+        m->data[1] = 126;
+        m->data[2] = (char)(len >> 8);
+        m->data[3] = (char)len;
+    }
+    memcpy(m->data + WS_HDR_ROOM, payload, (size_t)len);
+    return m;
+}
 
-    if (data_start >= g_pes_len) return;
+static const char *ws_payload(const struct ws_msg *m)
+{
+    return m->data + WS_HDR_ROOM;
+}
 
-    feed_pes_data(g_pes + data_start, g_pes_len - data_start);
+static const char *ws_frame(const struct ws_msg *m, int *len)
+{
+    int hdr = m->len < 126 ? 2 : 4;
+    *len = hdr + m->len;
+    return m->data + WS_HDR_ROOM - hdr;
 }
 
-/* ------------------------------------------------------------------ */
-/* Process one 188-byte TS packet                                      */
-static void process_ts_packet(const uint8_t *pkt)
+static void ws_msg_put(struct ws_msg *m)
 {
-    if (pkt[0] != TS_SYNC_BYTE)    return;
-    if (pkt[1] & 0x80)             return;  /* transport error        */
+    if (m && --m->refs == 0)
+        free(m);
+}
 
-    int pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
-    if (pid != g_pid)              return;
+struct cache_sub {
+    int                 subno;
+    uint32_t            stored;         /* time of last update         */
+    struct ws_msg      *msg;            /* NULL = no copy              */
+    struct ttx_page    *raw;            /* --render: the cells         */
+    uint64_t            hash;           /* of raw                      */
+    struct ws_msg      *png;            /* --render: HTTP response     */
+    uint64_t            png_hash;       /* raw->hash it was drawn from */
+};
 
-    int pus            = (pkt[1] >> 6) & 1;  /* payload_unit_start   */
-    int has_adaptation = (pkt[3] & 0x20) != 0;
-    int has_payload    = (pkt[3] & 0x10) != 0;
+struct cache_page {
+    struct cache_sub   *sub;
+    uint16_t            nsub;
+    uint16_t            cap;
+};
 
-    if (!has_payload) return;
+static struct cache_page *g_cache[MAX_STREAMS];
 
-    int payload_offset = 4;
-    if (has_adaptation) {
-        payload_offset = 5 + pkt[4];
-        if (payload_offset >= TS_PACKET_SIZE) return;
+static void cache_sub_clear(struct cache_sub *e)
+{
+    ws_msg_put(e->msg);
+    ws_msg_put(e->png);
+    free(e->raw);
+}
+
+/* Index of subno in cp, or where it would be inserted                */
+static int cache_find(const struct cache_page *cp, int subno)
+{
+    int lo = 0, hi = cp->nsub;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cp->sub[mid].subno < subno) lo = mid + 1;
+        else                            hi = mid;
     }
+    return lo;
+}
 
-    const uint8_t *payload     = pkt + payload_offset;
-    int            payload_len = TS_PACKET_SIZE - payload_offset;
-    if (payload_len <= 0) return;
+/* Replace the stored copy of a page.  Returns the new snapshot, or  */
+/* NULL if it could not be stored.                                     */
+static struct ws_msg *cache_store(const struct ttx_stream *s,
+                                  const struct ttx_page *pg)
+{
+    static char        buf[UDP_MAX_PAYLOAD];
+    struct cache_page **tab = &g_cache[s - g_streams];
 
-    if (pus) {
-        /* Dispatch whatever PES we have accumulated */
-        if (g_pes_len > 0)
-            dispatch_pes();
+    if (pg->pgno < 100 || pg->pgno > 899)
+        return NULL;
+    if (!*tab && !(*tab = calloc(CACHE_PAGES, sizeof(**tab))))
+        return NULL;
 
-        g_pes_len    = 0;
-        g_pes_target = 0;
+    struct cache_page *cp = &(*tab)[pg->pgno - 100];
+    int                i  = cache_find(cp, pg->subno);
 
-        /* Read expected PES size from new packet's header */
-        if (payload_len >= 6) {
-            int pes_pkt_len = (payload[4] << 8) | payload[5];
-            /* 0 = unbounded (common for video); for teletext it is set */
-            g_pes_target = (pes_pkt_len > 0) ? 6 + pes_pkt_len : 0;
+    if (i == cp->nsub || cp->sub[i].subno != pg->subno) {
+        if (cp->nsub == CACHE_SUBPAGES) {
+            int old = 0;
+            for (int k = 1; k < cp->nsub; k++)
+                if (cp->sub[k].stored < cp->sub[old].stored) old = k;
+            cache_sub_clear(&cp->sub[old]);
+            memmove(&cp->sub[old], &cp->sub[old + 1],
+                    (size_t)(cp->nsub - old - 1) * sizeof(*cp->sub));
+            cp->nsub--;
+            if (old < i) i--;
+        }
+        if (cp->nsub == cp->cap) {
+            int               cap = cp->cap ? cp->cap * 2 : 4;
+            struct cache_sub *sub;
+            if (cap > CACHE_SUBPAGES) cap = CACHE_SUBPAGES;
+            if (!(sub = realloc(cp->sub, (size_t)cap * sizeof(*sub))))
+                return NULL;
+            cp->sub = sub;
+            cp->cap = (uint16_t)cap;
         }
+        memmove(&cp->sub[i + 1], &cp->sub[i],
+                (size_t)(cp->nsub - i) * sizeof(*cp->sub));
+        memset(&cp->sub[i], 0, sizeof(*cp->sub));
+        cp->sub[i].subno = pg->subno;
+        cp->nsub++;
     }
 
-    /* Accumulate payload bytes */
-    if (g_pes_len + payload_len <= MAX_PES_SIZE) {
-        memcpy(g_pes + g_pes_len, payload, payload_len);
-        g_pes_len += payload_len;
-    } else {
-        fprintf(stderr, "ttxd: PES overflow, resetting\n");
-        g_pes_len    = 0;
-        g_pes_target = 0;
-        return;
-    }
+    struct cache_sub *e = &cp->sub[i];
+    struct ws_msg    *m = ws_msg_new(0x1, buf,
+                                     page_format(buf, pg, -1, PAGE_ALL_ROWS));
+    if (!m)
+        return NULL;                    /* keep the older copy        */
+    ws_msg_put(e->msg);
+    e->msg    = m;
+    e->stored = (uint32_t)time(NULL);
 
-    /* Dispatch as soon as PES is complete (bounded PES) */
-    if (g_pes_target > 0 && g_pes_len >= g_pes_target) {
-        dispatch_pes();
-        g_pes_len    = 0;
-        g_pes_target = 0;
+#ifdef HAVE_PNG
+    /* Only the cells and their hash: the image is drawn on request   */
+    if (g_render && (e->raw || (e->raw = malloc(sizeof(*e->raw))))) {
+        *e->raw = *pg;
+        e->hash = ttxd_render_hash(pg->text, pg->attr);
     }
+#endif
+    return m;
 }
 
-/* ------------------------------------------------------------------ */
-/* Process a raw chunk of MPEG-TS bytes, maintaining 188-byte         */
-/* packet alignment across call boundaries via the carry buffer.      */
-/* ------------------------------------------------------------------ */
-static void process_chunk(const uint8_t *data, size_t len)
+/* A page --dedupe found unchanged: the stored snapshot holds the    */
+/* same text, so only its time is refreshed.  Returns 0 if there is   */
+/* no snapshot to keep and the page has to be stored in full.          */
+static int cache_touch(const struct ttx_stream *s, const struct ttx_page *pg)
 {
-    size_t offset = 0;
-
-    /* 1. Drain the carry buffer first */
-    if (g_carry_len > 0) {
-        size_t need = (size_t)(TS_PACKET_SIZE - g_carry_len);
-        size_t take = (len < need) ? len : need;
-        memcpy(g_carry + g_carry_len, data, take);
-        g_carry_len += (int)take;
-        offset       = take;
+    struct cache_page *tab = g_cache[s - g_streams];
 
-        if (g_carry_len == TS_PACKET_SIZE) {
-            process_ts_packet(g_carry);
-            g_carry_len = 0;
-        }
-    }
+    if (!tab || pg->pgno < 100 || pg->pgno > 899)
+        return 0;
 
-    /* 2. Process complete packets directly from the buffer */
-    while (offset + TS_PACKET_SIZE <= len) {
-        process_ts_packet(data + offset);
-        offset += TS_PACKET_SIZE;
-    }
+    struct cache_page *cp = &tab[pg->pgno - 100];
+    int                i  = cache_find(cp, pg->subno);
 
-    /* 3. Save any remainder in carry */
-    size_t leftover = len - offset;
-    if (leftover > 0) {
-        memcpy(g_carry, data + offset, leftover);
-        g_carry_len = (int)leftover;
+    if (i == cp->nsub || cp->sub[i].subno != pg->subno || !cp->sub[i].msg)
+        return 0;
+    cp->sub[i].stored = (uint32_t)time(NULL);
+    return 1;
+}
+
+static void cache_free(void)
+{
+    for (int i = 0; i < g_nstreams; i++) {
+        if (!g_cache[i]) continue;
+        for (int p = 0; p < CACHE_PAGES; p++) {
+            for (int k = 0; k < g_cache[i][p].nsub; k++)
+                cache_sub_clear(&g_cache[i][p].sub[k]);
+            free(g_cache[i][p].sub);
+        }
+        free(g_cache[i]);
+    }
+}
+
+/* Answer one request: "[<udp-port>:]<page>[/<subpage>]".  Every      */
+/* stored subpage that matches goes back as its own datagram, then a  */
+/* summary saying how many there were.                                 */
+static void query_answer(const char *req, const struct sockaddr_in *to)
+{
+    char        buf[128];
+    const char *p = req;
+    char       *end;
+    long        port = 0, pgno, subno = -1;
+    int         si = 0, count = 0, len;
+
+    pgno = strtol(p, &end, 10);
+    if (end != p && *end == ':') {
+        port = pgno;
+        p    = end + 1;
+        pgno = strtol(p, &end, 10);
+    }
+    if (end != p && *end == '/') {
+        p     = end + 1;
+        subno = strtol(p, &end, 10);
+    }
+    while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+        end++;
+
+    if (port) {
+        for (si = 0; si < g_nstreams; si++)
+            if (udp_dest_port(&g_streams[si].dest[0]) == port) break;
+    }
+    if (end == p || *end || pgno < 100 || pgno > 899 || si == g_nstreams) {
+        len = snprintf(buf, sizeof(buf),
+                       "{\"type\":\"query\",\"error\":\"bad request\"}\n");
+        sendto(g_query_fd, buf, (size_t)len, 0,
+               (const struct sockaddr *)to, sizeof(*to));
+        return;
+    }
+
+    if (g_cache[si]) {
+        const struct cache_page *cp = &g_cache[si][pgno - 100];
+        for (int k = subno < 0 ? 0 : cache_find(cp, (int)subno);
+             k < cp->nsub && (subno < 0 || cp->sub[k].subno == subno); k++) {
+            const struct ws_msg *m = cp->sub[k].msg;
+            if (!m) continue;
+            if (sendto(g_query_fd, ws_payload(m), (size_t)m->len, 0,
+                       (const struct sockaddr *)to, sizeof(*to)) < 0) {
+                fprintf(stderr, "ttxd: query sendto: %s\n", strerror(errno));
+                return;
+            }
+            count++;
+        }
+    }
+
+    len = snprintf(buf, sizeof(buf),
+                   "{\"type\":\"query\",\"page\":%ld,\"subpages\":%d}\n",
+                   pgno, count);
+    sendto(g_query_fd, buf, (size_t)len, 0,
+           (const struct sockaddr *)to, sizeof(*to));
+}
+
+/* Answer every request waiting on the query socket                   */
+static void query_poll(void)
+{
+    for (;;) {
+        char               req[64];
+        struct sockaddr_in from;
+        socklen_t          flen = sizeof(from);
+        ssize_t            n = recvfrom(g_query_fd, req, sizeof(req) - 1,
+                                        MSG_DONTWAIT,
+                                        (struct sockaddr *)&from, &flen);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "ttxd: query recvfrom: %s\n", strerror(errno));
+            return;
+        }
+        req[n] = '\0';
+        query_answer(req, &from);
+    }
+}
+
+static void query_event(struct ev_handler *h, uint32_t events)
+{
+    (void)h; (void)events;
+    query_poll();
+}
+
+static struct ev_handler g_query_ev = { query_event };
+
+/* ------------------------------------------------------------------ */
+/* Page images (--render), output thread only.                        */
+/*                                                                     */
+/* The store keeps each subpage's cells and their hash, and an image  */
+/* is drawn only when one is asked for (ttxd_render.h: glyph atlas,    */
+/* whole-cell blits, one deflate at Z_BEST_SPEED).  The complete HTTP  */
+/* response, headers and PNG, is then kept with the subpage and sent   */
+/* as it is while the hash stays the same, so a kiosk polling a page   */
+/* that has not changed costs neither drawing nor compression.  The    */
+/* hash is also the ETag.                                              */
+/* ------------------------------------------------------------------ */
+#ifdef HAVE_PNG
+static struct ttxd_render *g_renderer;  /* atlas and framebuffer      */
+
+static struct ws_msg *render_response(struct cache_sub *e)
+{
+    const struct ttx_page *pg = e->raw;
+    char                   hdr[256];
+    struct ws_msg         *m;
+    long                   n;
+    int                    hlen;
+
+    if (e->png && e->png_hash == e->hash)
+        return e->png;
+
+    if (!g_renderer) {
+        if (!(g_renderer = malloc(sizeof(*g_renderer))))
+            return NULL;
+        ttxd_render_init(g_renderer);
+    }
+    ttxd_render_page(g_renderer, pg->text, pg->attr, 0);
+    if ((n = ttxd_render_png(g_renderer, Z_BEST_SPEED)) < 0)
+        return NULL;
+
+    hlen = snprintf(hdr, sizeof(hdr),
+                    "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\n"
+                    "Content-Length: %ld\r\nETag: \"%016llx\"\r\n"
+                    "Cache-Control: no-cache\r\nConnection: close\r\n\r\n",
+                    n, (unsigned long long)e->hash);
+    if (!(m = malloc(sizeof(*m) + WS_HDR_ROOM + (size_t)hlen + (size_t)n)))
+        return NULL;
+    m->refs = 1;
+    m->len  = hlen + (int)n;
+    memcpy(m->data + WS_HDR_ROOM, hdr, (size_t)hlen);
+    memcpy(m->data + WS_HDR_ROOM + hlen, g_renderer->png, (size_t)n);
+
+    ws_msg_put(e->png);
+    e->png      = m;
+    e->png_hash = e->hash;
+    return m;
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* HTTP / WebSocket server (--http), output thread only.              */
+/*                                                                     */
+/* Browsers connect to /ws?pages=100,101-199, or /events for          */
+/* Server-Sent Events, and get every page they asked for from the     */
+/* store straight away, then each new page as it is sent.  Both       */
+/* protocols send the shared snapshot buffers as they are: a          */
+/* WebSocket frame uses the header room in front, an event is written */
+/* as "data: ", the JSON and a blank line in one sendmsg().  All      */
+/* sockets sit in the output thread's epoll set (g_out_epfd); a       */
+/* client costs one struct and the frames it has not yet taken.       */
+/* Those are references to the shared snapshots, at most              */
+/* WEB_QUEUE_MAX of them: a client that falls that far behind is      */
+/* dropped rather than buffered for.                                  */
+/*                                                                     */
+/* The store snapshot is fed in through a cursor as the queue drains, */
+/* so it can be larger than the queue.                                 */
+/*                                                                     */
+/* With --render, GET /page/NNN.png answers with an image of a stored */
+/* page through the same queue, and the connection closes once it has */
+/* been sent.                                                          */
+/* ------------------------------------------------------------------ */
+enum web_state {
+    WEB_REQUEST,                        /* reading the request head    */
+    WEB_SOCKET,                         /* WebSocket open              */
+    WEB_EVENTS,                         /* text/event-stream open      */
+    WEB_FILE                            /* sending one response        */
+};
+
+struct web_client {
+    struct ev_handler   ev;             /* must be first               */
+    int                 fd;
+    enum web_state      state;
+    time_t              deadline;       /* WEB_REQUEST: give up then   */
+    uint32_t            events;         /* epoll mask registered       */
+    struct web_client  *prev, *next;
+
+    int                 stream;         /* index into g_streams        */
+    int                 subno;          /* /page: ?sub=, -1 = newest   */
+    uint8_t             pages[CACHE_PAGES / 8]; /* bit per page 100..899 */
+    int                 snap_page;      /* store cursor, CACHE_PAGES = done */
+    int                 snap_sub;
+
+    struct ws_msg      *q[WEB_QUEUE_MAX];
+    int                 qhead, qlen;
+    int                 qoff;           /* bytes of q[qhead] sent      */
+
+    int                 in_len;
+    char                in[WEB_IN_MAX];
+};
+
+struct web_server {
+    struct ev_handler   ev;             /* must be first               */
+    int                 fd;
+    int                 nclients;
+    struct web_client  *clients;
+    time_t              swept;          /* last request timeout sweep  */
+};
+
+static struct web_server g_web = { .fd = -1 };
+
+/* SHA-1 of a message under 120 bytes, for Sec-WebSocket-Accept only  */
+static void sha1_short(const uint8_t *msg, size_t len, uint8_t out[20])
+{
+    uint8_t  buf[128] = { 0 };
+    size_t   nblk = (len + 8) / 64 + 1;
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE,
+                      0x10325476, 0xC3D2E1F0 };
+
+    memcpy(buf, msg, len);
+    buf[len] = 0x80;
+    for (int i = 0; i < 8; i++)
+        buf[nblk * 64 - 1 - i] = (uint8_t)((uint64_t)len * 8 >> (8 * i));
+
+#define ROL(x, n) ((x) << (n) | (x) >> (32 - (n)))
+    for (size_t b = 0; b < nblk; b++) {
+        uint32_t w[80], a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4];
+
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *p = buf + b * 64 + i * 4;
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+                   (uint32_t)p[2] << 8  | p[3];
+        }
+        for (int i = 16; i < 80; i++)
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20)      { f = (bb & c) | (~bb & d);           k = 0x5A827999; }
+            else if (i < 40) { f = bb ^ c ^ d;                      k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (bb & c) | (bb & d) | (c & d);   k = 0x8F1BBCDC; }
+            else             { f = bb ^ c ^ d;                      k = 0xCA62C1D6; }
+            uint32_t t = ROL(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = ROL(bb, 30); bb = a; a = t;
+        }
+        h[0] += a; h[1] += bb; h[2] += c; h[3] += d; h[4] += e;
+    }
+#undef ROL
+
+    for (int i = 0; i < 20; i++)
+        out[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+/* Sec-WebSocket-Accept for a client key (RFC 6455 §4.2.2): 28 chars  */
+static void ws_accept(const char *key, int klen, char out[29])
+{
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    static const char b64[]  =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t msg[64 + sizeof(guid)], d[21];
+
+    memcpy(msg, key, (size_t)klen);
+    memcpy(msg + klen, guid, sizeof(guid) - 1);
+    sha1_short(msg, (size_t)klen + sizeof(guid) - 1, d);
+    d[20] = 0;
+
+    for (int i = 0, o = 0; i < 21; i += 3, o += 4) {
+        uint32_t v = (uint32_t)d[i] << 16 | (uint32_t)d[i + 1] << 8 |
+                     (i + 2 < 21 ? d[i + 2] : 0);
+        out[o]     = b64[v >> 18 & 63];
+        out[o + 1] = b64[v >> 12 & 63];
+        out[o + 2] = b64[v >> 6 & 63];
+        out[o + 3] = b64[v & 63];
+    }
+    out[27] = '=';
+    out[28] = '\0';
+}
+
+/* Parse "100,101,150-199" (or "" / "*" for every page) into a bitmap */
+static int web_parse_pages(const char *p, const char *end, uint8_t *bits)
+{
+    if (p == end || (end - p == 1 && *p == '*')) {
+        memset(bits, 0xFF, CACHE_PAGES / 8);
+        return 1;
+    }
+
+    memset(bits, 0, CACHE_PAGES / 8);
+    while (p < end) {
+        char *e;
+        long  lo = strtol(p, &e, 10), hi = lo;
+        if (e == p) return 0;
+        if (e < end && *e == '-') {
+            p  = e + 1;
+            hi = strtol(p, &e, 10);
+            if (e == p) return 0;
+        }
+        if (lo < 100 || hi > 899 || lo > hi) return 0;
+        for (long n = lo; n <= hi; n++)
+            bits[(n - 100) / 8] |= (uint8_t)(1 << ((n - 100) % 8));
+        p = e;
+        if (p < end && *p++ != ',') return 0;
+    }
+    return 1;
+}
+
+static int web_wants(const struct web_client *c, int pgno)
+{
+    return pgno >= 100 && pgno <= 899 &&
+           (c->pages[(pgno - 100) / 8] >> ((pgno - 100) % 8) & 1);
+}
+
+static void web_close(struct web_client *c)
+{
+    close(c->fd);
+    while (c->qlen) {
+        ws_msg_put(c->q[c->qhead]);
+        c->qhead = (c->qhead + 1) % WEB_QUEUE_MAX;
+        c->qlen--;
+    }
+    if (c->prev) c->prev->next = c->next;
+    else         g_web.clients = c->next;
+    if (c->next) c->next->prev = c->prev;
+    g_web.nclients--;
+    free(c);
+}
+
+static int web_queue(struct web_client *c, struct ws_msg *m)
+{
+    if (c->qlen == WEB_QUEUE_MAX)
+        return 0;
+    m->refs++;
+    c->q[(c->qhead + c->qlen) % WEB_QUEUE_MAX] = m;
+    c->qlen++;
+    return 1;
+}
+
+/* Top up the queue from the store snapshot, leaving half of it free  */
+/* for live pages                                                      */
+static void web_refill(struct web_client *c)
+{
+    const struct cache_page *tab = g_cache[c->stream];
+
+    while (c->snap_page < CACHE_PAGES && c->qlen < WEB_QUEUE_MAX / 2) {
+        const struct cache_page *cp = tab ? &tab[c->snap_page] : NULL;
+        if (!cp || !web_wants(c, c->snap_page + 100) ||
+            c->snap_sub >= cp->nsub) {
+            c->snap_page++;
+            c->snap_sub = 0;
+            continue;
+        }
+        struct ws_msg *m = cp->sub[c->snap_sub++].msg;
+        if (m) web_queue(c, m);
+    }
+}
+
+/* The unsent part of m as this client's protocol frames it.  Returns */
+/* the number of iovecs filled and the total length in *flen.          */
+static int web_iov(const struct web_client *c, const struct ws_msg *m,
+                   int off, struct iovec *iov, int *flen)
+{
+    static char sse_data[] = "data: ", sse_end[] = "\n";
+    int         n = 0;
+
+    if (c->state == WEB_SOCKET) {
+        iov[n].iov_base = (void *)ws_frame(m, flen);
+        iov[n++].iov_len = (size_t)*flen;
+    } else if (c->state == WEB_FILE) {
+        iov[n].iov_base = (void *)ws_payload(m);
+        iov[n++].iov_len = (size_t)m->len;
+        *flen = m->len;
+    } else {
+        iov[n].iov_base  = sse_data;
+        iov[n++].iov_len = 6;
+        iov[n].iov_base  = (void *)ws_payload(m);
+        iov[n++].iov_len = (size_t)m->len;
+        iov[n].iov_base  = sse_end;
+        iov[n++].iov_len = 1;
+        *flen = 6 + m->len + 1;
+    }
+
+    /* Skip what an earlier, partial send already took                */
+    int k = 0;
+    while (off >= (int)iov[k].iov_len)
+        off -= (int)iov[k++].iov_len;
+    iov[k].iov_base = (char *)iov[k].iov_base + off;
+    iov[k].iov_len -= (size_t)off;
+    memmove(iov, iov + k, (size_t)(n - k) * sizeof(*iov));
+    return n - k;
+}
+
+/* Send what the socket takes.  0 if the client has to go.            */
+static int web_flush(struct web_client *c)
+{
+    for (;;) {
+        if (c->qlen < WEB_QUEUE_MAX / 2)
+            web_refill(c);
+        if (!c->qlen)
+            break;
+
+        struct iovec  iov[3];
+        struct msghdr msg = { .msg_iov = iov };
+        int           flen;
+        msg.msg_iovlen = (size_t)web_iov(c, c->q[c->qhead], c->qoff, iov, &flen);
+
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return 0;
+        }
+        c->qoff += (int)n;
+        if (c->qoff == flen) {
+            ws_msg_put(c->q[c->qhead]);
+            c->qhead = (c->qhead + 1) % WEB_QUEUE_MAX;
+            c->qlen--;
+            c->qoff = 0;
+        }
+    }
+    if (c->state == WEB_FILE && !c->qlen)
+        return 0;                       /* all sent: close            */
+
+    uint32_t want = EPOLLIN | (c->qlen ? EPOLLOUT : 0);
+    if (want != c->events) {
+        struct epoll_event ev = { .events = want, .data.ptr = c };
+        if (epoll_ctl(g_out_epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+            return 0;
+        c->events = want;
+    }
+    return 1;
+}
+
+/* Queue a frame and send it, dropping the client if that fails       */
+static void web_send(struct web_client *c, struct ws_msg *m)
+{
+    if (!web_queue(c, m)) {
+        fprintf(stderr, "ttxd: http: dropping %s client that"
+                        " stopped reading\n",
+                c->state == WEB_SOCKET ? "WebSocket" : "event stream");
+        web_close(c);
+    } else if (!web_flush(c)) {
+        web_close(c);
+    }
+}
+
+/* A page was sent: pass it on to every WebSocket that wants it       */
+static void web_publish(const struct ttx_stream *s, int pgno, struct ws_msg *m)
+{
+    int si = (int)(s - g_streams);
+
+    for (struct web_client *c = g_web.clients, *next; c; c = next) {
+        next = c->next;
+        if ((c->state == WEB_SOCKET || c->state == WEB_EVENTS) &&
+            c->stream == si && web_wants(c, pgno))
+            web_send(c, m);
+    }
+}
+
+/* Plain HTTP answer, then close.  hdrs holds extra header lines,    */
+/* each ending in CRLF, or is NULL; a NULL body sends the head alone. */
+static void web_reply(struct web_client *c, const char *status,
+                      const char *hdrs, const char *body)
+{
+    char    buf[512];
+    int     len = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\n%s", status,
+                           hdrs ? hdrs : "");
+    if (body)
+        len += snprintf(buf + len, sizeof(buf) - (size_t)len,
+                        "Content-Type: text/plain\r\nContent-Length: %zu\r\n",
+                        strlen(body));
+    len += snprintf(buf + len, sizeof(buf) - (size_t)len,
+                    "Connection: close\r\n\r\n%s", body ? body : "");
+    ssize_t n = send(c->fd, buf, (size_t)len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    (void)n;
+    web_close(c);
+}
+
+/* Value of a request header, up to the end of its line               */
+static const char *web_header(const char *head, const char *name, int *len)
+{
+    size_t nlen = strlen(name);
+
+    for (const char *l = strstr(head, "\r\n"); l; l = strstr(l, "\r\n")) {
+        l += 2;
+        if (strncasecmp(l, name, nlen) == 0 && l[nlen] == ':') {
+            const char *v = l + nlen + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            *len = (int)strcspn(v, "\r\n");
+            while (*len > 0 && (v[*len - 1] == ' ' || v[*len - 1] == '\t'))
+                (*len)--;
+            return v;
+        }
+    }
+    return NULL;
+}
+
+/* Apply the query string: pages=<list>, port=<udp-port of the       */
+/* stream>, sub=<subpage>.  0 if a reply has been sent instead.        */
+static int web_on_query(struct web_client *c, const char *p, const char *qend)
+{
+    memset(c->pages, 0xFF, sizeof(c->pages));
+    c->stream = 0;
+    c->subno  = -1;
+
+    while (p < qend) {
+        const char *amp = memchr(p, '&', (size_t)(qend - p));
+        const char *e   = amp ? amp : qend;
+
+        if (e - p >= 6 && memcmp(p, "pages=", 6) == 0) {
+            if (!web_parse_pages(p + 6, e, c->pages)) {
+                web_reply(c, "400 Bad Request", NULL, "bad page list\n");
+                return 0;
+            }
+        } else if (e - p >= 5 && memcmp(p, "port=", 5) == 0) {
+            long port = strtol(p + 5, NULL, 10);
+            int  si;
+            for (si = 0; si < g_nstreams; si++)
+                if (udp_dest_port(&g_streams[si].dest[0]) == port) break;
+            if (si == g_nstreams) {
+                web_reply(c, "404 Not Found", NULL,
+                          "no stream on that port\n");
+                return 0;
+            }
+            c->stream = si;
+        } else if (e - p >= 4 && memcmp(p, "sub=", 4) == 0) {
+            c->subno = atoi(p + 4);
+        }
+        p = e + (amp != NULL);
+    }
+    return 1;
+}
+
+#ifdef HAVE_PNG
+/* GET /page/NNN.png: the stored subpage asked for, or the one stored */
+/* last, drawn and encoded only if it changed since it was last asked */
+/* for.  A client that sends the ETag back gets 304 for an unchanged  */
+/* page.                                                               */
+static void web_on_image(struct web_client *c, int pgno)
+{
+    struct cache_page *tab = g_cache[c->stream];
+    struct cache_page *cp  = tab ? &tab[pgno - 100] : NULL;
+    struct cache_sub  *e   = NULL;
+    struct ws_msg     *m;
+    const char        *inm;
+    char               tag[24];
+    int                len;
+
+    for (int k = 0; cp && k < cp->nsub; k++) {
+        struct cache_sub *s = &cp->sub[k];
+        if (c->subno >= 0 ? s->subno == c->subno
+                          : !e || s->stored >= e->stored)
+            e = s;
+    }
+    if (!e || !e->raw) {
+        web_reply(c, "404 Not Found", NULL, "page not in store\n");
+        return;
+    }
+
+    /* The tag is the page hash, so a match needs no rendering        */
+    snprintf(tag, sizeof(tag), "\"%016llx\"", (unsigned long long)e->hash);
+    inm = web_header(c->in, "If-None-Match", &len);
+    if (inm && len == 18 && memcmp(inm, tag, 18) == 0) {
+        char etag[40];
+        snprintf(etag, sizeof(etag), "ETag: %s\r\n", tag);
+        web_reply(c, "304 Not Modified", etag, NULL);
+        return;
+    }
+
+    if (!(m = render_response(e))) {
+        web_reply(c, "503 Service Unavailable", NULL, "out of memory\n");
+        return;
+    }
+
+    c->state    = WEB_FILE;
+    c->deadline = time(NULL) + HTTP_TIMEOUT;
+    c->in_len   = 0;
+    web_queue(c, m);
+    if (!web_flush(c))
+        web_close(c);
+}
+#endif
+
+static int web_on_frames(struct web_client *c);
+
+/* Complete request head in c->in: upgrade /ws, start /events, serve  */
+/* /page/NNN.png, or refuse                                            */
+static void web_on_request(struct web_client *c)
+{
+    char       *head = c->in;
+    char        resp[256];
+    int         len;
+
+    if (strncmp(head, "GET ", 4) != 0) {
+        web_reply(c, "405 Method Not Allowed", NULL, "GET only\n");
+        return;
+    }
+
+    char       *path = head + 4;
+    size_t      plen = strcspn(path, " \r\n");
+    char       *qs   = memchr(path, '?', plen);
+    size_t      flen = qs ? (size_t)(qs - path) : plen;
+    const char *qend = path + plen;
+
+    if (flen == 3 && memcmp(path, "/ws", 3) == 0) {
+        const char *key, *upg;
+        char        acc[29];
+        int         klen = 0, ulen = 0;
+
+        upg = web_header(head, "Upgrade", &ulen);
+        key = web_header(head, "Sec-WebSocket-Key", &klen);
+        if (!upg || ulen != 9 || strncasecmp(upg, "websocket", 9) != 0 ||
+            !key || klen < 16 || klen > 64) {
+            web_reply(c, "400 Bad Request", NULL,
+                      "WebSocket upgrade expected\n");
+            return;
+        }
+        if (!web_on_query(c, qs ? qs + 1 : qend, qend))
+            return;
+
+        ws_accept(key, klen, acc);
+        len = snprintf(resp, sizeof(resp),
+                       "HTTP/1.1 101 Switching Protocols\r\n"
+                       "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: %s\r\n\r\n", acc);
+        c->state = WEB_SOCKET;
+    } else if (flen == 7 && memcmp(path, "/events", 7) == 0) {
+        if (!web_on_query(c, qs ? qs + 1 : qend, qend))
+            return;
+
+        len = snprintf(resp, sizeof(resp),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "Connection: keep-alive\r\n\r\n");
+        c->state = WEB_EVENTS;
+#ifdef HAVE_PNG
+    } else if (g_render && flen > 10 && memcmp(path, "/page/", 6) == 0 &&
+               memcmp(path + flen - 4, ".png", 4) == 0) {
+        char *e;
+        long  pgno = strtol(path + 6, &e, 10);
+
+        if (e != path + flen - 4 || pgno < 100 || pgno > 899) {
+            web_reply(c, "404 Not Found", NULL, "pages are /page/100.png"
+                                                " to /page/899.png\n");
+            return;
+        }
+        if (web_on_query(c, qs ? qs + 1 : qend, qend))
+            web_on_image(c, (int)pgno);
+        return;
+#endif
+    } else {
+        web_reply(c, "404 Not Found", NULL, g_render
+                  ? "endpoints are /ws, /events and /page/NNN.png\n"
+                  : "endpoints are /ws and /events\n");
+        return;
+    }
+
+    if (send(c->fd, resp, (size_t)len, MSG_NOSIGNAL | MSG_DONTWAIT) != len) {
+        web_close(c);
+        return;
+    }
+
+    /* A client may send its first frame in the same segment as the  */
+    /* handshake: keep whatever followed the head                      */
+    int hlen = (int)(strstr(c->in, "\r\n\r\n") + 4 - c->in);
+
+    c->snap_page = 0;
+    c->snap_sub  = 0;
+    c->in_len   -= hlen;
+    memmove(c->in, c->in + hlen, (size_t)c->in_len);
+    if (c->state == WEB_SOCKET) {
+        web_on_frames(c);               /* flushes, or closes         */
+        return;
+    }
+    c->in_len = 0;                      /* nothing to hear from them  */
+    if (!web_flush(c))
+        web_close(c);
+}
+
+/* Frames from the client: a text frame holds a new page list, pings  */
+/* are answered, close ends the connection.  0 if the client is gone. */
+static int web_on_frames(struct web_client *c)
+{
+    uint8_t *in = (uint8_t *)c->in;
+
+    while (c->in_len >= 2) {
+        int op  = in[0] & 0x0F;
+        int len = in[1] & 0x7F;
+        int hdr = 2;
+
+        if (!(in[1] & 0x80) || len == 127) {
+            web_close(c);               /* unmasked, or far too big   */
+            return 0;
+        }
+        if (len == 126) {
+            if (c->in_len < 4) break;
+            len = in[2] << 8 | in[3];
+            hdr = 4;
+        }
+        if (hdr + 4 + len > WEB_IN_MAX) {
+            web_close(c);
+            return 0;
+        }
+        if (c->in_len < hdr + 4 + len) break;
+
+        uint8_t *mask = in + hdr, *pl = in + hdr + 4;
+        for (int i = 0; i < len; i++)
+            pl[i] ^= mask[i % 4];
+
+        if (op == 0x8) {                /* close: echo and go         */
+            struct ws_msg *m = ws_msg_new(0x8, (const char *)pl,
+                                          len < 2 ? len : 2);
+            if (m) {
+                int         flen;
+                const char *f = ws_frame(m, &flen);
+                ssize_t     n = send(c->fd, f, (size_t)flen,
+                                     MSG_NOSIGNAL | MSG_DONTWAIT);
+                (void)n;
+                ws_msg_put(m);
+            }
+            web_close(c);
+            return 0;
+        }
+        if (op == 0x9 && len <= 125) {  /* ping                        */
+            struct ws_msg *m = ws_msg_new(0xA, (const char *)pl, len);
+            if (!m || !web_queue(c, m)) {
+                ws_msg_put(m);
+                web_close(c);
+                return 0;
+            }
+            ws_msg_put(m);
+        }
+        if (op == 0x1 && (in[0] & 0x80)) {
+            if (web_parse_pages((const char *)pl, (const char *)pl + len,
+                                c->pages)) {
+                c->snap_page = 0;       /* resend from the store      */
+                c->snap_sub  = 0;
+            }
+        }
+
+        c->in_len -= hdr + 4 + len;
+        memmove(in, in + hdr + 4 + len, (size_t)c->in_len);
+    }
+
+    if (!web_flush(c)) {
+        web_close(c);
+        return 0;
+    }
+    return 1;
+}
+
+static void web_client_event(struct ev_handler *h, uint32_t events)
+{
+    struct web_client *c = (struct web_client *)h;
+
+    if (events & EPOLLIN) {
+        int     room = WEB_IN_MAX - 1 - c->in_len;
+        ssize_t n    = recv(c->fd, c->in + c->in_len, (size_t)room, 0);
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            web_close(c);
+            return;
+        }
+        if (n > 0) {
+            c->in_len += (int)n;
+            c->in[c->in_len] = '\0';
+        }
+
+        if (c->state == WEB_REQUEST) {
+            if (strstr(c->in, "\r\n\r\n"))
+                web_on_request(c);
+            else if (c->in_len == WEB_IN_MAX - 1)
+                web_reply(c, "431 Request Header Fields Too Large", NULL,
+                          "\n");
+            return;
+        }
+        if (c->state != WEB_SOCKET)
+            c->in_len = 0;              /* nothing to hear from them  */
+        else if (!web_on_frames(c))
+            return;
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+        web_close(c);
+        return;
+    }
+
+    if (events & EPOLLOUT && !web_flush(c))
+        web_close(c);
+}
+
+static void web_accept_event(struct ev_handler *h, uint32_t events)
+{
+    (void)h; (void)events;
+
+    for (;;) {
+        int fd = accept4(g_web.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "ttxd: http accept: %s\n", strerror(errno));
+            return;
+        }
+
+        struct web_client *c = NULL;
+        if (g_web.nclients < WEB_CLIENTS_MAX)
+            c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+
+        c->ev.fn     = web_client_event;
+        c->fd        = fd;
+        c->state     = WEB_REQUEST;
+        c->deadline  = time(NULL) + HTTP_TIMEOUT;
+        c->events    = EPOLLIN;
+        c->snap_page = CACHE_PAGES;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (epoll_ctl(g_out_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next = g_web.clients;
+        if (c->next) c->next->prev = c;
+        g_web.clients = c;
+        g_web.nclients++;
+    }
+}
+
+/* Drop connections that have not finished their request, or taken   */
+/* their image, in time                                                */
+static void web_timers(void)
+{
+    time_t now = time(NULL);
+
+    if (g_web.fd < 0 || now == g_web.swept)
+        return;
+    g_web.swept = now;
+    for (struct web_client *c = g_web.clients, *next; c; c = next) {
+        next = c->next;
+        if ((c->state == WEB_REQUEST || c->state == WEB_FILE) &&
+            now >= c->deadline)
+            web_close(c);
+    }
+}
+
+/* Listen on "[addr:]port", 127.0.0.1 by default                      */
+static int web_listen(const char *spec)
+{
+    struct sockaddr_in addr;
+    const char        *colon = strrchr(spec, ':');
+    int                port  = atoi(colon ? colon + 1 : spec);
+    int                one   = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (colon) {
+        char host[64];
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            fprintf(stderr, "ttxd: invalid --http address %s\n", host);
+            return 0;
+        }
+    }
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "ttxd: invalid --http port in %s\n", spec);
+        return 0;
+    }
+    addr.sin_port = htons((uint16_t)port);
+
+    g_web.ev.fn = web_accept_event;
+    g_web.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_web.fd < 0) { perror("ttxd: http socket"); return 0; }
+    setsockopt(g_web.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(g_web.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(g_web.fd, 128) < 0) {
+        fprintf(stderr, "ttxd: http %s: %s\n", spec, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+static void web_free(void)
+{
+    while (g_web.clients)
+        web_close(g_web.clients);
+    if (g_web.fd >= 0) close(g_web.fd);
+#ifdef HAVE_PNG
+    free(g_renderer);
+#endif
+}
+
+/* Output thread: handle whatever is ready on the query and HTTP      */
+/* sockets, without waiting                                            */
+static void out_poll(void)
+{
+    struct epoll_event events[64];
+    int                n = epoll_wait(g_out_epfd, events, 64, 0);
+
+    for (int i = 0; i < n; i++) {
+        struct ev_handler *h = events[i].data.ptr;
+        h->fn(h, events[i].events);
+    }
+    web_timers();
+}
+
+/* ------------------------------------------------------------------ */
+/* Per-page output state (--dedupe, --delta), output thread only.     */
+/*                                                                     */
+/* Carousels repeat most pages every 10–30 s with identical text, and */
+/* many that do change only touch a row or two.  Each (stream, page,  */
+/* subpage) keeps hashes of its text as last sent, in an              */
+/* open-addressed table that doubles when half full:                  */
+/*                                                                     */
+/*   --dedupe  a page whose hash matches is not formatted or sent,    */
+/*             unless the last send is g_heartbeat seconds old.  The  */
+/*             clock in the last eight columns of the header row      */
+/*             changes on every transmission and is left out.         */
+/*   --delta   only rows whose hash changed are sent, with a full     */
+/*             snapshot at least every g_delta seconds.  Each message */
+/*             for a page carries the next number of its sequence, so */
+/*             a consumer can tell when it missed one.                */
+/* ------------------------------------------------------------------ */
+struct page_seen {
+    uint32_t            key;            /* stream, page, subpage; 0 = free */
+    uint32_t            sent;           /* time of last send           */
+    uint64_t            hash;           /* page, without header clock  */
+    uint32_t            full;           /* time of last full snapshot  */
+    uint32_t            seq;            /* last sequence number sent   */
+    uint32_t            row[TTX_ROWS];  /* row hashes as last sent     */
+};
+
+static struct page_seen *g_seen;
+static unsigned          g_seen_cap;    /* power of 2                  */
+static unsigned          g_seen_used;
+
+/* Stream index in bits 26–31 (MAX_STREAMS is 64), page number in    */
+/* 16–25 and the whole 16-bit subpage below; never 0, as pages start  */
+/* at 100                                                              */
+static uint32_t page_key(const struct ttx_stream *s, const struct ttx_page *pg)
+{
+    return (uint32_t)(s - g_streams) << 26 | (uint32_t)pg->pgno << 16 |
+           (uint32_t)(pg->subno & 0xFFFF);
+}
+
+/* FNV-1a over the output characters, one code point at a time: a    */
+/* hash per row into rh[], and the page hash as the result.  With     */
+/* --attributes the attribute word goes in above the code point, so   */
+/* a change of colour alone counts as a change.                       */
+static uint64_t page_hash(const struct ttx_page *pg, uint32_t *rh)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (int row = 0; row < TTX_ROWS; row++) {
+        uint64_t r = 14695981039346656037ULL;
+        for (int col = 0; col < TTX_COLS; col++) {
+            uint64_t c = page_char(pg->text[row][col]);
+            if (g_attrs)
+                c |= (uint64_t)pg->attr[row][col] << 32;
+            r = (r ^ c) * 1099511628211ULL;
+            if (row > 0 || col < TTX_COLS - 8)
+                h = (h ^ c) * 1099511628211ULL;
+        }
+        rh[row] = (uint32_t)(r ^ r >> 32);
+    }
+    return h;
+}
+
+static struct page_seen *seen_slot(struct page_seen *tab, unsigned cap,
+                                   uint32_t key)
+{
+    unsigned i = (key * 2654435761u) & (cap - 1);
+    while (tab[i].key && tab[i].key != key)
+        i = (i + 1) & (cap - 1);
+    return &tab[i];
+}
+
+static int seen_grow(void)
+{
+    unsigned          cap = g_seen_cap ? g_seen_cap * 2 : 1024;
+    struct page_seen *tab = calloc(cap, sizeof(*tab));
+    if (!tab) return 0;
+
+    for (unsigned i = 0; i < g_seen_cap; i++)
+        if (g_seen[i].key)
+            *seen_slot(tab, cap, g_seen[i].key) = g_seen[i];
+    free(g_seen);
+    g_seen     = tab;
+    g_seen_cap = cap;
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Shared-memory page ring (--shm)                                     */
+/*                                                                     */
+/* A POSIX shared memory object laid out as in ttxd_shm.h.  Only the  */
+/* output thread writes to it; readers in other processes map it      */
+/* read-only and rely on the per-slot seqlock and on head and the      */
+/* index being stored with release ordering after the slot.           */
+/* ------------------------------------------------------------------ */
+#define SHM_ALIGN(n)    (((n) + 63) & ~(size_t)63)
+
+/* Create the object for NAME[,SLOTS], replacing one left by an        */
+/* earlier run; readers of that one keep their mapping until they     */
+/* notice closed and reopen                                            */
+static int shm_ring_open(const char *spec)
+{
+    const char *comma  = strchr(spec, ',');
+    const char *name   = spec[0] == '/' ? spec + 1 : spec;
+    int         nlen   = comma ? (int)(comma - name) : (int)strlen(name);
+    long        nslots = comma ? atol(comma + 1) : 1024;
+
+    if (nlen < 1 || nlen > 200 || memchr(name, '/', (size_t)nlen) ||
+        nslots < 16 || nslots > 65536 || (nslots & (nslots - 1))) {
+        fprintf(stderr, "ttxd: --shm must be NAME[,SLOTS], SLOTS a power"
+                        " of 2 in 16..65536\n");
+        return 0;
+    }
+    snprintf(g_shm_name, sizeof(g_shm_name), "/%.*s", nlen, name);
+
+    size_t index = SHM_ALIGN(sizeof(struct ttxd_shm_header));
+    size_t slots = SHM_ALIGN(index + (size_t)g_nstreams * TTXD_SHM_PAGES *
+                                     sizeof(uint64_t));
+    size_t size  = slots + (size_t)nslots * sizeof(struct ttxd_shm_slot);
+
+    shm_unlink(g_shm_name);
+    int fd = shm_open(g_shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)size) < 0) {
+        fprintf(stderr, "ttxd: shm %s: %s\n", g_shm_name, strerror(errno));
+        if (fd >= 0) { close(fd); shm_unlink(g_shm_name); }
+        return 0;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "ttxd: shm %s: %s\n", g_shm_name, strerror(errno));
+        shm_unlink(g_shm_name);
+        return 0;
+    }
+
+    /* ftruncate() zero-filled it: head, index and slot seqs are 0    */
+    g_shm = p;
+    g_shm->version   = TTXD_SHM_VERSION;
+    g_shm->size      = (uint32_t)size;
+    g_shm->nslots    = (uint32_t)nslots;
+    g_shm->slot_size = sizeof(struct ttxd_shm_slot);
+    g_shm->slots     = (uint32_t)slots;
+    g_shm->index     = (uint32_t)index;
+    g_shm->nstreams  = (uint32_t)g_nstreams;
+    g_shm->rows      = TTX_ROWS;
+    g_shm->cols      = TTX_COLS;
+    g_shm->pid       = (uint32_t)getpid();
+    for (int i = 0; i < g_nstreams; i++)
+        g_shm->port[i] = (uint16_t)udp_dest_port(&g_streams[i].dest[0]);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(g_shm->magic, TTXD_SHM_MAGIC, 4);
+
+    fprintf(stderr, "ttxd: shm ring /dev/shm%s: %ld slots, %zu KiB\n",
+            g_shm_name, nslots, size / 1024);
+    return 1;
+}
+
+/* Copy a page into the next slot (output thread)                     */
+static void shm_ring_write(const struct ttx_stream *s,
+                           const struct ttx_page *pg)
+{
+    struct timespec       ts;
+    uint64_t              serial = g_shm->head;
+    struct ttxd_shm_slot *slot   = (struct ttxd_shm_slot *)(void *)
+        ((char *)g_shm + g_shm->slots +
+         (size_t)(serial & (g_shm->nslots - 1)) * sizeof(*slot));
+    uint64_t             *index  = (uint64_t *)(void *)
+        ((char *)g_shm + g_shm->index);
+    uint32_t              seq    = slot->seq;
+
+    if (pg->pgno < 100 || pg->pgno >= 100 + TTXD_SHM_PAGES)
+        return;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    /* Odd while the contents change; the fence keeps the stores      */
+    /* below from being seen before it                                 */
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->stream  = (uint16_t)(s - g_streams);
+    slot->port    = g_shm->port[s - g_streams];
+    slot->pgno    = pg->pgno;
+    slot->subno   = pg->subno;
+    slot->serial  = serial;
+    slot->time_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    memcpy(slot->text, pg->text, sizeof(slot->text));
+    memcpy(slot->attr, pg->attr, sizeof(slot->attr));
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&index[(size_t)(s - g_streams) * TTXD_SHM_PAGES +
+                            (size_t)(pg->pgno - 100)],
+                     serial + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_shm->head, serial + 1, __ATOMIC_RELEASE);
+}
+
+/* Tell readers the ring is finished with, and take the name away     */
+static void shm_ring_close(void)
+{
+    if (!g_shm) return;
+    __atomic_store_n(&g_shm->closed, 1, __ATOMIC_RELEASE);
+    munmap(g_shm, g_shm->size);
+    shm_unlink(g_shm_name);
+    g_shm = NULL;
+}
+
+/* Send a page as the output options ask: skipped, as the rows that   */
+/* changed, or in full                                                 */
+static void page_output(struct ttx_stream *s, const struct ttx_page *pg)
+{
+    static char    buf[UDP_MAX_PAYLOAD];
+    struct ws_msg *snap = NULL;
+    uint32_t       rows = PAGE_ALL_ROWS;
+    long           seq  = -1;
+
+    if (g_shm)
+        shm_ring_write(s, pg);
+
+    /* Without state, or memory for it, every page goes out in full  */
+    if ((g_dedupe || g_delta) &&
+        (g_seen_used < g_seen_cap / 2 || seen_grow())) {
+        uint32_t          rh[TTX_ROWS];
+        uint32_t          now  = (uint32_t)time(NULL);
+        uint64_t          hash = page_hash(pg, rh);
+        uint32_t          key  = page_key(s, pg);
+        struct page_seen *e    = seen_slot(g_seen, g_seen_cap, key);
+        int               seen = e->key != 0;
+
+        if (g_dedupe && seen && e->hash == hash &&
+            (g_heartbeat == 0 || now - e->sent < (uint32_t)g_heartbeat)) {
+            if (g_cache_on && !cache_touch(s, pg))
+                cache_store(s, pg);
+            __atomic_fetch_add(&s->stats.pages_unchanged, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        if (g_delta && seen && now - e->full < (uint32_t)g_delta) {
+            rows = 0;
+            for (int r = 0; r < TTX_ROWS; r++)
+                if (rh[r] != e->row[r]) rows |= 1u << r;
+        }
+
+        if (!seen) {
+            e->key = key;
+            g_seen_used++;
+        }
+        if (rows == PAGE_ALL_ROWS)
+            e->full = now;
+        e->sent = now;
+        e->hash = hash;
+        memcpy(e->row, rh, sizeof(rh));
+        if (g_delta)
+            seq = (long)++e->seq;
+    }
+
+    /* The store and the web clients always take JSON               */
+    if (g_cache_on)
+        snap = cache_store(s, pg);
+    if (snap)
+        web_publish(s, pg->pgno, snap);
+    if (g_binary)
+        udp_send(s, buf, page_format_bin(buf, pg, seq, rows));
+    else if (snap && rows == PAGE_ALL_ROWS && seq < 0)
+        udp_send(s, ws_payload(snap), snap->len);
+    else
+        udp_send(s, buf, page_format(buf, pg, seq, rows));
+}
+
+/* Hand a complete page to the output thread                          */
+static void page_emit(struct ttx_stream *s, const struct ttx_page *pg)
+{
+    struct out_msg *m = out_msg_get();
+    if (!m) return;
+
+    m->s      = s;
+    m->len    = 0;
+    m->u.page = *pg;
+    spsc_push(&g_pipe.out, m);
+}
+
+#ifdef HAVE_ZVBI
+/* ------------------------------------------------------------------ */
+/* VBI event callback — fires when a complete TTX page is decoded     */
+static void ttx_event_cb(vbi_event *ev, void *user_data)
+{
+    struct ttx_stream *s = user_data;
+    if (ev->type != VBI_EVENT_TTX_PAGE) return;
+
+    int pgno  = ev->ev.ttx_page.pgno;
+    int subno = ev->ev.ttx_page.subno & 0xFFFF;
+
+    vbi_page page;
+    if (!vbi_fetch_vt_page(s->dec, &page, pgno, subno,
+                           VBI_WST_LEVEL_1p5, 25, TRUE))
+        return;
+
+    /* pgno/subno are BCD (0x100 = page 100)                          */
+    static struct ttx_page pg;
+    pg.pgno  = bcd_to_dec(pgno);
+    pg.subno = bcd_to_dec(subno);
+    pg.pts   = s->pts;
+    if (pg.subno < 0) pg.subno = 0;
+
+    int cols = page.columns < TTX_COLS ? page.columns : TTX_COLS;
+    for (int row = 0; row < TTX_ROWS; row++) {
+        for (int col = 0; col < TTX_COLS; col++) {
+            if (row >= page.rows || col >= cols) {
+                pg.text[row][col] = 0x20;
+                pg.attr[row][col] = TTXD_ATTR_DEFAULT;
+                continue;
+            }
+
+            /* Level 1.5 colours are the first eight of the map; a    */
+            /* box shows in opacity, which is not carried over         */
+            const vbi_char *ch = &page.text[row * page.columns + col];
+            pg.text[row][col] = ch->unicode;
+            pg.attr[row][col] = (uint16_t)(
+                TTXD_ATTR_COLOURS(ch->foreground & 7, ch->background & 7) |
+                (ch->flash   ? TTXD_ATTR_FLASH   : 0) |
+                (ch->conceal ? TTXD_ATTR_CONCEAL : 0) |
+                (ch->size == VBI_DOUBLE_HEIGHT || ch->size == VBI_DOUBLE_SIZE
+                             ? TTXD_ATTR_DOUBLE  : 0));
+        }
+    }
+
+    vbi_unref_page(&page);
+    if (pg.pgno > 0)
+        page_emit(s, &pg);
+}
+#endif /* HAVE_ZVBI */
+
+/* ------------------------------------------------------------------ */
+/* PES fragment list                                                   */
+/*                                                                     */
+/* A teletext PES is a few KB spread over a dozen or so TS packets,   */
+/* and those usually arrive in the same recv().  Rather than copy     */
+/* every payload into a linear buffer, the reassembler records        */
+/* (pointer, length) references into the receive buffer and feeds     */
+/* them to the decoder in order once the PES is complete.  A PES that */
+/* is still open when process_chunk() hands the buffer back — or     */
+/* that went through the carry buffer — is copied into a spill buffer */
+/* from a shared free list, and only then.                            */
+/* ------------------------------------------------------------------ */
+static void pes_reset(struct ttx_stream *s)
+{
+    s->nfrag      = 0;
+    s->pes_len    = 0;
+    s->pes_target = 0;
+    if (s->spill) {
+        s->spill->next = g_spill_free;
+        g_spill_free   = s->spill;
+        s->spill       = NULL;
+    }
+}
+
+/* Copy the referenced fragments into the stream's spill buffer.      */
+/* Returns 0 (and drops the PES) if no memory could be had.           */
+static int pes_spill(struct ttx_stream *s)
+{
+    if (s->nfrag == 0) return 1;
+
+    struct pes_spill *b = s->spill;
+    if (!b) {
+        b = g_spill_free;
+        if (b) {
+            g_spill_free = b->next;
+        } else {
+            b = malloc(sizeof(*b) + PES_SPILL_SIZE);
+            if (b) b->cap = PES_SPILL_SIZE;
+        }
+        if (b) b->len = 0;
+        s->spill = b;
+    }
+    if (b && b->cap < s->pes_len) {
+        int cap = b->cap;
+        while (cap < s->pes_len) cap *= 2;
+        if (cap > MAX_PES_SIZE) cap = MAX_PES_SIZE;
+        struct pes_spill *nb = realloc(b, sizeof(*b) + (size_t)cap);
+        if (nb) nb->cap = cap;
+        else    free(b);
+        s->spill = b = nb;
+    }
+    if (!b) {
+        stream_log(s, "PES spill buffer allocation failed");
+        s->stats.pes_dropped++;
+        pes_reset(s);
+        s->pes_wait_pus = 1;
+        return 0;
+    }
+
+    for (int i = 0; i < s->nfrag; i++) {
+        memcpy(b->data + b->len, s->frags[i].p, (size_t)s->frags[i].len);
+        b->len += s->frags[i].len;
+        s->stats.pes_copied += (uint64_t)s->frags[i].len;
+    }
+    s->nfrag = 0;
+    return 1;
+}
+
+/* Append one TS payload to the PES being assembled                   */
+static void pes_add(struct ttx_stream *s, const uint8_t *p, int len)
+{
+    if (s->nfrag == PES_FRAG_MAX && !pes_spill(s))
+        return;
+    s->frags[s->nfrag].p   = p;
+    s->frags[s->nfrag].len = len;
+    s->nfrag++;
+    s->pes_len += len;
+}
+
+/* Gather the first n bytes of the PES (n <= pes_len)                 */
+static void pes_peek(const struct ttx_stream *s, uint8_t *dst, int n)
+{
+    int got = 0;
+
+    if (s->spill) {
+        got = s->spill->len < n ? s->spill->len : n;
+        memcpy(dst, s->spill->data, (size_t)got);
+    }
+    for (int i = 0; got < n && i < s->nfrag; i++) {
+        int take = s->frags[i].len < n - got ? s->frags[i].len : n - got;
+        memcpy(dst + got, s->frags[i].p, (size_t)take);
+        got += take;
+    }
+}
+
+#ifdef HAVE_ZVBI
+/* ------------------------------------------------------------------ */
+/* Feed PES bytes into libzvbi.  The demux keeps its own state, so a  */
+/* PES can be handed over in any number of pieces.                    */
+static void feed_pes_data(struct ttx_stream *s, const uint8_t *data, int len)
+{
+    const uint8_t  *p   = data;
+    unsigned int    rem = (unsigned int)len;
+
+    while (rem > 0) {
+        vbi_sliced   sliced[64];
+        int64_t      pts     = 0;
+
+        unsigned int lines = vbi_dvb_demux_cor(s->demux,
+                                               sliced, 64,
+                                               &pts,
+                                               &p, &rem);
+        if (lines > 0)
+            vbi_decode(s->dec, sliced, (int)lines,
+                       (double)pts / 90000.0);
+
+        /* If no lines were produced and rem didn't shrink, break     */
+        if (lines == 0 && rem == (unsigned int)(p - data + rem))
+            break;
+    }
+}
+
+#endif /* HAVE_ZVBI */
+
+/* ------------------------------------------------------------------ */
+/* Native teletext decoder (--native)                                  */
+/*                                                                     */
+/* Replaces vbi_dvb_demux_cor() + vbi_decode() for the text path.     */
+/* The PES payload is a data_identifier byte followed by data units   */
+/* (EN 300 472 §4.3); each teletext unit carries one 42-byte packet,  */
+/* bit-reversed relative to the VBI line.  Packets are assembled into */
+/* pages per magazine following EN 300 706 level 1: a page starts     */
+/* with its header (packet 0) and ends with the next header in the    */
+/* same magazine, or in any magazine when the serial flag C11 is set. */
+/* Only packets 0–24 are used; enhancement packets 26–31 and the      */
+/* page cache libzvbi keeps are not reproduced.                       */
+/* ------------------------------------------------------------------ */
+
+/* Decode n parity-coded display bytes into Unicode and display      */
+/* attributes, tracking the level 1 spacing attributes.  Parity for   */
+/* the whole row is checked in one pass by ham_par_row().             */
+static void ttx_decode_row(unsigned int *out, uint16_t *attr,
+                           const uint8_t *d, int n, int national)
+{
+    uint8_t  chr[TTX_COLS];
+    uint64_t bad = ham_par_row(chr, d, n);
+    int      graphics = 0, separated = 0;
+    unsigned fg = 7, bg = 0, flags = 0;
+
+    for (int i = 0; i < n; i++) {
+        int c = chr[i], set = -1;
+        unsigned int cp;
+
+        if (bad & (1ULL << i)) {
+            cp = 0x20;                  /* parity error               */
+        } else if (c < 0x20) {
+            cp  = 0x20;                 /* spacing attribute; these   */
+            set = c;                    /* apply from this cell on    */
+            if (c == 0x09)      flags &= ~TTXD_ATTR_FLASH;
+            else if (c == 0x0C) flags &= ~TTXD_ATTR_DOUBLE;
+            else if (c == 0x18) flags |= TTXD_ATTR_CONCEAL;
+            else if (c == 0x19) separated = 0;
+            else if (c == 0x1A) separated = 1;
+            else if (c == 0x1C) bg = 0;
+            else if (c == 0x1D) bg = fg;
+        } else if (graphics && (c & 0x20)) {
+            cp = (separated ? 0xEF00u : 0xEE00u) + (unsigned int)c;
+        } else if (c == 0x7F) {
+            cp = 0x25A0;                /* ■                          */
+        } else {
+            cp = ttxd_g0(national, c);
+        }
+        out[i]  = cp;
+        attr[i] = (uint16_t)(TTXD_ATTR_COLOURS(fg, bg) | flags);
+
+        /* The rest apply from the next cell on                        */
+        if (set < 0) continue;
+        if (set <= 0x07 || (set >= 0x10 && set <= 0x17)) {
+            graphics = set >= 0x10;
+            fg       = (unsigned)set & 7;
+            flags   &= ~TTXD_ATTR_CONCEAL;
+        } else if (set == 0x08) {
+            flags |= TTXD_ATTR_FLASH;
+        } else if (set == 0x0A) {
+            flags &= ~TTXD_ATTR_BOXED;
+        } else if (set == 0x0B) {
+            flags |= TTXD_ATTR_BOXED;
+        } else if (set == 0x0D) {
+            flags |= TTXD_ATTR_DOUBLE;
+        }
+    }
+}
+
+struct mag_worker;
+static void mag_publish(struct mag_worker *w, struct ttx_stream *s,
+                        uint64_t seq, const struct ttx_page *pg);
+
+/* A page ends: emit it if it has a displayable (decimal) number.     */
+/* On a magazine worker (w != NULL) it goes to the ordered merge      */
+/* instead, tagged with the sequence number of the job that ended it. */
+static void ttx_mag_finish(struct ttx_stream *s, struct ttx_mag *m,
+                           struct mag_worker *w, uint64_t seq)
+{
+    if (m->active && m->page.pgno > 0) {
+        m->page.pts = m->pts;
+        if (w) mag_publish(w, s, seq, &m->page);
+        else   page_emit(s, &m->page);
+    }
+    m->active = 0;
+}
+
+/* Apply packet y of magazine mag to the page in progress there.      */
+/* Header fields have already been checked by ttx_packet().           */
+static void ttx_mag_packet(struct ttx_stream *s, struct ttx_mag *m,
+                           int mag, int y, const uint8_t *d,
+                           struct mag_worker *w, uint64_t seq)
+{
+    if (y == 0) {
+        int h[8];
+        for (int i = 0; i < 8; i++) h[i] = ham84(d[2 + i]);
+
+        /* Any header in this magazine ends its current page */
+        ttx_mag_finish(s, m, w, seq);
+        if (h[0] == 0xF && h[1] == 0xF)
+            return;                     /* time filling header        */
+
+        int pg = bcd_to_dec(h[1] << 4 | h[0]);
+        int sub = bcd_to_dec(h[2] | (h[3] & 7) << 4 | h[4] << 8 |
+                             (h[5] & 3) << 12);
+
+        m->active        = 1;
+        m->national      = ttxd_national(h[7]);
+        m->page.pgno     = pg < 0 ? 0 : (mag ? mag : 8) * 100 + pg;
+        m->page.subno    = sub < 0 ? 0 : sub;
+        for (int r = 0; r < TTX_ROWS; r++)
+            for (int c = 0; c < TTX_COLS; c++) {
+                m->page.text[r][c] = 0x20;
+                m->page.attr[r][c] = TTXD_ATTR_DEFAULT;
+            }
+
+        /* Columns 0–7 of row 0 are the decoder's, left blank here    */
+        ttx_decode_row(&m->page.text[0][8], &m->page.attr[0][8], d + 10,
+                       TTX_COLS - 8, m->national);
+    } else if (m->active) {
+        ttx_decode_row(m->page.text[y], m->page.attr[y], d + 2, TTX_COLS,
+                       m->national);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Magazine workers (--mag-workers)                                    */
+/*                                                                     */
+/* Page assembly in one magazine never looks at another, so packets   */
+/* can be handed to worker threads by magazine number (magazine m     */
+/* goes to worker m % N) and assembled in parallel.  A serial-mode    */
+/* header, which ends the pages of every magazine, becomes a FINISH   */
+/* job per magazine on the dispatching side.                          */
+/*                                                                     */
+/* Every job takes a number from one global sequence.  A worker       */
+/* publishes each finished page tagged with the number of the job     */
+/* that finished it, and then records that job as done.  The demux    */
+/* thread merges what was published and emits a page only once no     */
+/* busy worker is still behind it, so pages leave in exactly the      */
+/* order the inline decoder would produce.  Workers wake the demux    */
+/* thread through an eventfd when they go idle or have published a    */
+/* page, and the demux thread merges again after every chunk while    */
+/* pages wait on a busy worker, so none is held back indefinitely.    */
+/* ------------------------------------------------------------------ */
+enum { MAG_PACKET, MAG_FINISH, MAG_RESET };
+
+struct mag_job {
+    struct ttx_stream  *s;
+    uint64_t            seq;
+    int64_t             pts;
+    uint8_t             op;
+    uint8_t             mag;
+    uint8_t             y;
+    uint8_t             data[TTX_PKT_SIZE];
+};
+
+/* A finished page waiting in the ordered merge                       */
+struct mag_page {
+    struct mag_page    *next;
+    struct ttx_stream  *s;
+    uint64_t            seq;
+    struct ttx_page     page;
+};
+
+struct mag_worker {
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      more;           /* job queued, or stopping     */
+    pthread_cond_t      space;          /* job taken off a full queue  */
+    struct mag_job      jobs[MAG_QUEUE_SIZE];
+    unsigned            head, tail;     /* producer / consumer counts  */
+    uint64_t            queued;         /* seq of last job submitted   */
+    uint64_t            done;           /* seq of last job completed   */
+    struct mag_page    *out;            /* published, not yet merged   */
+    struct mag_page   **out_tail;
+    int                 stop;
+};
+
+struct mag_pool {
+    int                 efd;            /* eventfd, workers → demux    */
+    int                 n;              /* 0 = assemble inline         */
+    uint64_t            seq;
+    struct mag_page    *pending;        /* merged, sorted by seq       */
+    struct mag_worker   w[8];
+};
+
+static struct mag_pool g_mag = { .efd = -1 };
+
+/* Worker side: queue a copy of a finished page for the merge         */
+static void mag_publish(struct mag_worker *w, struct ttx_stream *s,
+                        uint64_t seq, const struct ttx_page *pg)
+{
+    struct mag_page *p = malloc(sizeof(*p));
+    if (!p) {
+        fprintf(stderr, "ttxd: page allocation failed, page %d dropped\n",
+                pg->pgno);
+        return;
+    }
+    p->next = NULL;
+    p->s    = s;
+    p->seq  = seq;
+    p->page = *pg;
+
+    pthread_mutex_lock(&w->lock);
+    *w->out_tail = p;
+    w->out_tail  = &p->next;
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *mag_worker_main(void *arg)
+{
+    struct mag_worker *w = arg;
+    struct mag_job     job;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->head == w->tail && !w->stop)
+            pthread_cond_wait(&w->more, &w->lock);
+        if (w->head == w->tail)
+            break;                      /* stopping and drained        */
+
+        job = w->jobs[w->tail % MAG_QUEUE_SIZE];
+        w->tail++;
+        pthread_cond_signal(&w->space);
+        pthread_mutex_unlock(&w->lock);
+
+        struct ttx_mag *m = &job.s->ttx->mag[job.mag];
+        m->pts = job.pts;
+        switch (job.op) {
+        case MAG_PACKET:
+            ttx_mag_packet(job.s, m, job.mag, job.y, job.data, w, job.seq);
+            break;
+        case MAG_FINISH:
+            ttx_mag_finish(job.s, m, w, job.seq);
+            break;
+        case MAG_RESET:
+            memset(m, 0, sizeof(*m));
+            break;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->done = job.seq;
+        if (w->head == w->tail || w->out) {
+            uint64_t one = 1;
+            ssize_t  r   = write(g_mag.efd, &one, sizeof(one));
+            (void)r;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* Dispatcher side: hand one job to the worker owning the magazine,   */
+/* waiting if its queue is full                                        */
+static void mag_submit(struct ttx_stream *s, int op, int mag, int y,
+                       const uint8_t *d)
+{
+    struct mag_worker *w = &g_mag.w[mag % g_mag.n];
+
+    pthread_mutex_lock(&w->lock);
+    while (w->head - w->tail == MAG_QUEUE_SIZE)
+        pthread_cond_wait(&w->space, &w->lock);
+
+    struct mag_job *j = &w->jobs[w->head % MAG_QUEUE_SIZE];
+    j->s   = s;
+    j->seq = ++g_mag.seq;
+    j->pts = s->pts;
+    j->op  = (uint8_t)op;
+    j->mag = (uint8_t)mag;
+    j->y   = (uint8_t)y;
+    if (d) memcpy(j->data, d, TTX_PKT_SIZE);
+    w->queued = j->seq;
+    w->head++;
+
+    pthread_cond_signal(&w->more);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Demux thread: collect published pages and emit those that no busy  */
+/* worker can still precede                                            */
+static void mag_merge(void)
+{
+    uint64_t safe = UINT64_MAX;
+
+    for (int i = 0; i < g_mag.n; i++) {
+        struct mag_worker *w = &g_mag.w[i];
+
+        pthread_mutex_lock(&w->lock);
+        struct mag_page *list = w->out;
+        w->out      = NULL;
+        w->out_tail = &w->out;
+        if (w->done != w->queued && w->done < safe)
+            safe = w->done;
+        pthread_mutex_unlock(&w->lock);
+
+        /* Each worker's list is already in order: merge it in */
+        struct mag_page **pp = &g_mag.pending;
+        while (list) {
+            struct mag_page *p = list;
+            list = p->next;
+            while (*pp && (*pp)->seq < p->seq) pp = &(*pp)->next;
+            p->next = *pp;
+            *pp     = p;
+            pp      = &p->next;
+        }
+    }
+
+    while (g_mag.pending && g_mag.pending->seq <= safe) {
+        struct mag_page *p = g_mag.pending;
+        g_mag.pending = p->next;
+        page_emit(p->s, &p->page);
+        free(p);
+    }
+}
+
+/* Demux thread: merge if a worker has gone idle or published a page  */
+/* since the last look, or if merged pages are still held back        */
+static void mag_poll(void)
+{
+    uint64_t cnt;
+    if (read(g_mag.efd, &cnt, sizeof(cnt)) > 0 || g_mag.pending)
+        mag_merge();
+}
+
+/* Start g_mag.n workers and their wake-up eventfd                    */
+static int mag_pool_start(void)
+{
+    int n = g_mag.n;
+
+    /* Until a worker runs, mag_pool_stop() has nothing to join */
+    g_mag.n   = 0;
+    g_mag.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_mag.efd < 0) { perror("ttxd: eventfd"); return 0; }
+
+    for (int i = 0; i < n; i++) {
+        struct mag_worker *w = &g_mag.w[i];
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->more, NULL);
+        pthread_cond_init(&w->space, NULL);
+        w->out_tail = &w->out;
+        if (pthread_create(&w->thread, NULL, mag_worker_main, w) != 0) {
+            fprintf(stderr, "ttxd: cannot start magazine worker %d\n", i);
+            return 0;
+        }
+        g_mag.n = i + 1;
+    }
+    fprintf(stderr, "ttxd: %d magazine worker%s\n", n, n == 1 ? "" : "s");
+    return 1;
+}
+
+/* Let the workers drain their queues, then emit what they finished   */
+static void mag_pool_stop(void)
+{
+    for (int i = 0; i < g_mag.n; i++) {
+        struct mag_worker *w = &g_mag.w[i];
+        pthread_mutex_lock(&w->lock);
+        w->stop = 1;
+        pthread_cond_signal(&w->more);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+    }
+    mag_merge();
+    if (g_mag.efd >= 0) close(g_mag.efd);
+    g_mag.efd = -1;
+}
+
+/* Route one magazine operation inline or to its worker               */
+static void ttx_mag_op(struct ttx_stream *s, int op, int mag, int y,
+                       const uint8_t *d)
+{
+    if (g_mag.n > 0) {
+        mag_submit(s, op, mag, y, d);
+        return;
+    }
+
+    struct ttx_mag *m = &s->ttx->mag[mag];
+    m->pts = s->pts;
+    switch (op) {
+    case MAG_PACKET: ttx_mag_packet(s, m, mag, y, d, NULL, 0); break;
+    case MAG_FINISH: ttx_mag_finish(s, m, NULL, 0);            break;
+    case MAG_RESET:  memset(m, 0, sizeof(*m));                 break;
+    }
+}
+
+/* Drop every page in progress, e.g. when the teletext PID changes    */
+static void ttx_reset(struct ttx_stream *s)
+{
+    for (int mag = 0; mag < 8; mag++)
+        ttx_mag_op(s, MAG_RESET, mag, 0, NULL);
+}
+
+/* One 42-byte teletext packet, as transmitted                         */
+static void ttx_packet(struct ttx_stream *s, const uint8_t *d)
+{
+    int a = ham84(d[0]), b = ham84(d[1]);
+
+    if (a < 0 || b < 0) { s->stats.ham_errors++; return; }
+
+    int mag = a & 7;
+    int y   = (a >> 3) | (b << 1);
+
+    if (y == 0) {
+        /* A header with a damaged field still ends the current page */
+        for (int i = 2; i < 10; i++) {
+            if (ham84(d[i]) < 0) {
+                s->stats.ham_errors++;
+                ttx_mag_op(s, MAG_FINISH, mag, 0, NULL);
+                return;
+            }
+        }
+
+        /* Serial mode (C11): the header ends the pages of every      */
+        /* magazine, its own first                                     */
+        if (ham84(d[9]) & 1) {
+            ttx_mag_op(s, MAG_FINISH, mag, 0, NULL);
+            for (int i = 0; i < 8; i++)
+                if (i != mag) ttx_mag_op(s, MAG_FINISH, i, 0, NULL);
+        }
+    } else if (y >= TTX_ROWS) {
+        return;                         /* packets 25–31 not used      */
+    }
+
+    ttx_mag_op(s, MAG_PACKET, mag, y, d);
+}
+
+/* Walks the PES payload one data unit at a time; units can straddle  */
+/* fragments, so a partial one is gathered in unit[]                  */
+struct ttx_pes_parse {
+    int                 skip;           /* PES header bytes left       */
+    int                 id_seen;        /* data_identifier consumed    */
+    int                 bad;            /* not EBU data: ignore rest   */
+    int                 len;
+    uint8_t             unit[2 + 255];
+};
+
+static void ttx_data_unit(struct ttx_stream *s, const uint8_t *u)
+{
+    /* EBU teletext (non-subtitle / subtitle) units are 44 bytes:     */
+    /* field/line offset, framing code, then the 42-byte packet       */
+    if ((u[0] == 0x02 || u[0] == 0x03) && u[1] == 0x2C && u[3] == 0xE4)
+        ttx_packet(s, u + 4);
+}
+
+static void ttx_native_feed(struct ttx_stream *s, struct ttx_pes_parse *ps,
+                            const uint8_t *p, int n)
+{
+    while (n > 0 && !ps->bad) {
+        if (ps->skip > 0) {
+            int take = n < ps->skip ? n : ps->skip;
+            ps->skip -= take; p += take; n -= take;
+            continue;
+        }
+        if (!ps->id_seen) {
+            ps->id_seen = 1;
+            ps->bad     = (*p < 0x10 || *p > 0x1F);
+            p++; n--;
+            continue;
+        }
+
+        /* Whole unit in this fragment: use it in place */
+        if (ps->len == 0 && n >= 2 && n >= 2 + p[1]) {
+            int ulen = 2 + p[1];
+            ttx_data_unit(s, p);
+            p += ulen; n -= ulen;
+            continue;
+        }
+
+        ps->unit[ps->len++] = *p++; n--;
+        if (ps->len >= 2 && ps->len == 2 + ps->unit[1]) {
+            ttx_data_unit(s, ps->unit);
+            ps->len = 0;
+        }
+    }
+}
+
+/* Allocate (or clear) the native decoder state of a stream           */
+static int native_init(struct ttx_stream *s)
+{
+    if (!s->ttx) s->ttx = calloc(1, sizeof(*s->ttx));
+    if (!s->ttx) {
+        fprintf(stderr, "ttxd: native decoder allocation failed\n");
+        return 0;
+    }
+    ttx_reset(s);
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Check the PES header and pass the packet to the decoder, one piece */
+/* at a time.  libzvbi's PES demux finds the start code and skips the */
+/* header itself, so the bytes go through unchanged; the native       */
+/* decoder is told where the payload starts.                          */
+/*                                                                     */
+/* PES header layout (ISO 13818-1 §2.4.3.7):                         */
+/*   0..2  : start code 0x00 0x00 0x01                                */
+/*   3     : stream_id                                                 */
+/*   4..5  : PES_packet_length (0 = unbounded for video/audio)        */
+/*   6     : '10' + flags                                              */
+/*   7     : flags                                                     */
+/*   8     : PES_header_data_length (N)                               */
+/*   9..9+N: optional fields (PTS, DTS, ...)                          */
+/*   9+N.. : payload (for teletext: data_identifier + data units)     */
+/*                                                                     */
+/* With PTS_DTS_flags (byte 7, bit 7) set, the PTS is the first five  */
+/* optional bytes: 33 bits split 3/15/15 around marker bits.          */
+/* ------------------------------------------------------------------ */
+static void dispatch_pes(struct ttx_stream *s)
+{
+    uint8_t pes[14];
+
+    if (s->pes_len < 9 || !s->decoding) return;
+    pes_peek(s, pes, s->pes_len < 14 ? 9 : 14);
+    if (pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01)
+        return;                         /* missing start code         */
+
+    int hdr_data_len = pes[8];
+    int data_start   = 9 + hdr_data_len;
+
+    if (data_start >= s->pes_len) return;
+
+    s->pts = -1;
+    if ((pes[7] & 0x80) && hdr_data_len >= 5 && s->pes_len >= 14)
+        s->pts = (int64_t)(pes[9] >> 1 & 7) << 30 |
+                 (int64_t)(pes[10] << 7 | pes[11] >> 1) << 15 |
+                 (int64_t)(pes[12] << 7 | pes[13] >> 1);
+
+    if (g_native) {
+        struct ttx_pes_parse ps;
+        ps.skip = data_start; ps.id_seen = 0; ps.bad = 0; ps.len = 0;
+        if (s->spill)
+            ttx_native_feed(s, &ps, s->spill->data, s->spill->len);
+        for (int i = 0; i < s->nfrag; i++)
+            ttx_native_feed(s, &ps, s->frags[i].p, s->frags[i].len);
+        return;
+    }
+#ifdef HAVE_ZVBI
+    if (s->spill)
+        feed_pes_data(s, s->spill->data, s->spill->len);
+    for (int i = 0; i < s->nfrag; i++)
+        feed_pes_data(s, s->frags[i].p, s->frags[i].len);
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/* PID pre-filter                                                      */
+/*                                                                     */
+/* Most packets in a multiplex are video/audio that process_ts_packet */
+/* would drop after the PID compare.  The pre-filter checks a whole   */
+/* batch of packets at once and returns a bitmask of the ones worth   */
+/* parsing.  It reads the first header word of each packet (little-   */
+/* endian, so byte 0 is the low byte):                                 */
+/*                                                                     */
+/*   bits  0..7  : sync byte (0x47)                                    */
+/*   bit   15    : transport_error_indicator                           */
+/*   bits  8..12 : PID[12:8]                                           */
+/*   bits 16..23 : PID[7:0]                                            */
+/*                                                                     */
+/* Masked with TS_HDR_MASK, a packet passes iff the word equals the   */
+/* key of a wanted PID — sync, TEI and PID in a single compare.       */
+/* ------------------------------------------------------------------ */
+#define TS_HDR_MASK 0x00FF9FFFu
+
+static uint32_t ts_hdr_key(int pid)
+{
+    return TS_SYNC_BYTE | ((uint32_t)(pid >> 8) << 8) |
+           ((uint32_t)(pid & 0xFF) << 16);
+}
+
+typedef uint64_t (*ts_filter_fn)(const uint8_t *, int,
+                                 const uint32_t *, int);
+
+static uint64_t ts_filter_scalar(const uint8_t *p, int n,
+                                 const uint32_t *keys, int nkeys)
+{
+    uint64_t hits = 0;
+    for (int i = 0; i < n; i++, p += TS_PACKET_SIZE) {
+        uint32_t w = ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                      (uint32_t)p[2] << 16) & TS_HDR_MASK;
+        for (int k = 0; k < nkeys; k++)
+            if (w == keys[k]) { hits |= 1ULL << i; break; }
+    }
+    return hits;
+}
+
+#ifdef HAVE_X86_SIMD
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/* Four packets per step: one 32-bit lane per packet header           */
+static uint64_t ts_filter_sse2(const uint8_t *p, int n,
+                               const uint32_t *keys, int nkeys)
+{
+    const __m128i mask = _mm_set1_epi32((int)TS_HDR_MASK);
+    uint64_t      hits = 0;
+    int           i    = 0;
+
+    for (; i + 4 <= n; i += 4, p += 4 * TS_PACKET_SIZE) {
+        __m128i w  = _mm_set_epi32((int)load32(p + 3 * TS_PACKET_SIZE),
+                                   (int)load32(p + 2 * TS_PACKET_SIZE),
+                                   (int)load32(p + 1 * TS_PACKET_SIZE),
+                                   (int)load32(p));
+        __m128i eq = _mm_setzero_si128();
+        w = _mm_and_si128(w, mask);
+        for (int k = 0; k < nkeys; k++)
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi32(w,
+                                  _mm_set1_epi32((int)keys[k])));
+        hits |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+    }
+    if (i < n)
+        hits |= ts_filter_scalar(p, n - i, keys, nkeys) << i;
+    return hits;
+}
+
+/* Eight packets per step, headers fetched with a single gather       */
+__attribute__((target("avx2")))
+static uint64_t ts_filter_avx2(const uint8_t *p, int n,
+                               const uint32_t *keys, int nkeys)
+{
+    const __m256i mask = _mm256_set1_epi32((int)TS_HDR_MASK);
+    const __m256i offs = _mm256_setr_epi32(0, 1 * TS_PACKET_SIZE,
+                                           2 * TS_PACKET_SIZE,
+                                           3 * TS_PACKET_SIZE,
+                                           4 * TS_PACKET_SIZE,
+                                           5 * TS_PACKET_SIZE,
+                                           6 * TS_PACKET_SIZE,
+                                           7 * TS_PACKET_SIZE);
+    uint64_t      hits = 0;
+    int           i    = 0;
+
+    for (; i + 8 <= n; i += 8, p += 8 * TS_PACKET_SIZE) {
+        __m256i w  = _mm256_i32gather_epi32((const int *)(const void *)p,
+                                            offs, 1);
+        __m256i eq = _mm256_setzero_si256();
+        w = _mm256_and_si256(w, mask);
+        for (int k = 0; k < nkeys; k++)
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(w,
+                                     _mm256_set1_epi32((int)keys[k])));
+        hits |= (uint64_t)(uint32_t)
+                _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+    if (i < n)
+        hits |= ts_filter_sse2(p, n - i, keys, nkeys) << i;
+    return hits;
+}
+#endif /* HAVE_X86_SIMD */
+
+static ts_filter_fn g_ts_filter = ts_filter_scalar;
+
+static void ts_filter_select(void)
+{
+#ifdef HAVE_X86_SIMD
+    g_ts_filter = ts_filter_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        g_ts_filter = ts_filter_avx2;
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/* PSI: PAT/PMT parsing for teletext PID discovery                    */
+/*                                                                     */
+/* The PAT (PID 0) names the PMT PID of the program; the PMT lists    */
+/* its elementary streams.  Teletext is stream_type 0x06 (private    */
+/* PES) carrying a teletext_descriptor (0x56, or 0x46 for VBI         */
+/* teletext).  Both tables are followed by version number, so a       */
+/* broadcaster moving teletext to another PID is picked up live.      */
+/* ------------------------------------------------------------------ */
+static uint32_t g_crc32_table[256];
+
+static void crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i << 24;
+        for (int k = 0; k < 8; k++)
+            c = (c & 0x80000000u) ? (c << 1) ^ 0x04C11DB7u : c << 1;
+        g_crc32_table[i] = c;
+    }
+}
+
+/* CRC-32/MPEG-2; running it over a section including its CRC_32     */
+/* field yields 0 when the section is intact.                         */
+static uint32_t crc32_mpeg(const uint8_t *p, int len)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len-- > 0)
+        crc = (crc << 8) ^ g_crc32_table[(crc >> 24) ^ *p++];
+    return crc;
+}
+
+/* Rebuild the pre-filter keys: PAT, PMT (once known), teletext PID   */
+static void stream_set_filter(struct ttx_stream *s)
+{
+    s->nfilter = 0;
+    s->filter_keys[s->nfilter++] = ts_hdr_key(0);
+    if (s->pmt_pid > 0)
+        s->filter_keys[s->nfilter++] = ts_hdr_key(s->pmt_pid);
+    if (s->pid > 0)
+        s->filter_keys[s->nfilter++] = ts_hdr_key(s->pid);
+    s->filter_gen++;
+}
+
+/* Switch PES reassembly to a new teletext PID                         */
+static void stream_set_pid(struct ttx_stream *s, int pid)
+{
+    s->pid        = pid;
+    pes_reset(s);
+    s->pes_cc       = -1;
+    s->pes_wait_pus = 1;
+#ifdef HAVE_ZVBI
+    if (s->demux) vbi_dvb_demux_reset(s->demux);
+#endif
+    if (s->ttx)   ttx_reset(s);
+    stream_set_filter(s);
+}
+
+static void pat_parse(struct ttx_stream *s, const uint8_t *sec, int len)
+{
+    int version = (sec[5] >> 1) & 0x1F;
+    if (version == s->pat_version) return;
+    s->pat_version = version;
+
+    /* program loop: program_number(16) reserved(3) PID(13) ...       */
+    for (int i = 8; i + 4 <= len - 4; i += 4) {
+        int program = (sec[i] << 8) | sec[i + 1];
+        int pid     = ((sec[i + 2] & 0x1F) << 8) | sec[i + 3];
+        if (program == 0) continue;     /* network_PID (NIT)           */
+
+        if (pid != s->pmt_pid) {
+            stream_log(s, "PAT v%d: program %d, PMT PID %d",
+                       version, program, pid);
+            s->pmt_pid     = pid;
+            s->pmt_version = -1;
+            s->pmt.started = 0;
+            s->pmt.cc      = -1;
+            stream_set_filter(s);
+        }
+        return;                         /* HDHomeRun sends one program */
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Teletext page index from the teletext_descriptor                   */
+/*                                                                     */
+/* Each 5-byte descriptor entry (EN 300 468 §6.2.43) announces one    */
+/* page: ISO 639 language(24) teletext_type(5) magazine(3) page(8,   */
+/* BCD).  The list is published on the output socket as a metadata   */
+/* datagram so consumers can go straight to the subtitle and index    */
+/* pages instead of waiting for a whole carousel cycle.               */
+/* ------------------------------------------------------------------ */
+static const char *ttx_type_name(int type)
+{
+    switch (type) {
+    case 0x01: return "initial";
+    case 0x02: return "subtitle";
+    case 0x03: return "info";
+    case 0x04: return "schedule";
+    case 0x05: return "subtitle_hi";   /* for hearing impaired people */
+    default:   return "reserved";
+    }
+}
+
+/* Decode descriptor body d[0..dlen) into s->index[]                  */
+/* Returns 1 if the list differs from the one already held.           */
+static int ttx_index_parse(struct ttx_stream *s, const uint8_t *d, int dlen)
+{
+    struct ttx_index_entry idx[TTX_INDEX_MAX];
+    int                    n = 0;
+
+    for (int i = 0; i + 5 <= dlen && n < TTX_INDEX_MAX; i += 5) {
+        struct ttx_index_entry *e = &idx[n];
+        int mag   = d[i + 3] & 0x07;
+        int tens  = d[i + 4] >> 4;
+        int units = d[i + 4] & 0x0F;
+        if (tens > 9 || units > 9) continue;    /* not a display page */
+
+        memset(e, 0, sizeof(*e));
+        for (int k = 0; k < 3; k++) {
+            uint8_t c = d[i + k];
+            e->lang[k] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                       ? (char)c : '?';
+        }
+        e->type = d[i + 3] >> 3;
+        e->page = (mag ? mag : 8) * 100 + tens * 10 + units;
+        n++;
+    }
+
+    if (n == s->nindex &&
+        memcmp(idx, s->index, (size_t)n * sizeof(idx[0])) == 0)
+        return 0;
+
+    memcpy(s->index, idx, (size_t)n * sizeof(idx[0]));
+    s->nindex = n;
+    return 1;
+}
+
+/* Send the page index as a metadata datagram:                         */
+/*   {"type":"index","pid":409,"ts":1708789200,"pages":[              */
+/*     {"page":100,"type":"initial","lang":"deu"}, ...]}              */
+static void ttx_index_publish(struct ttx_stream *s)
+{
+    struct out_msg *m = out_msg_get();
+    if (!m) return;
+
+    char *buf = m->u.raw;
+    int   pos = snprintf(buf, sizeof(m->u.raw),
+                         "{\"type\":\"index\",\"pid\":%d,\"ts\":%ld,\"pages\":[",
+                         s->pid, (long)time(NULL));
+
+    for (int i = 0; i < s->nindex && pos < (int)sizeof(m->u.raw) - 64; i++) {
+        const struct ttx_index_entry *e = &s->index[i];
+        pos += snprintf(buf + pos, sizeof(m->u.raw) - pos,
+                        "%s{\"page\":%d,\"type\":\"%s\",\"lang\":\"%s\"}",
+                        i ? "," : "", e->page, ttx_type_name(e->type),
+                        e->lang);
+    }
+    pos += snprintf(buf + pos, sizeof(m->u.raw) - pos, "]}\n");
+
+    m->s   = s;
+    m->len = pos;
+    spsc_push(&g_pipe.out, m);
+    s->index_next = time(NULL) + TTX_INDEX_REPEAT;
+}
+
+static void pmt_parse(struct ttx_stream *s, const uint8_t *sec, int len)
+{
+    int version = (sec[5] >> 1) & 0x1F;
+    if (version == s->pmt_version) return;
+    s->pmt_version = version;
+
+    int program  = (sec[3] << 8) | sec[4];
+    int info_len = ((sec[10] & 0x0F) << 8) | sec[11];
+    int found    = 0;
+    int old_pid  = s->pid;
+
+    /* Teletext descriptor of the first teletext ES, and of the ES on  */
+    /* the PID given on the command line if there is one               */
+    const uint8_t *desc       = NULL, *fixed_desc = NULL;
+    int            desc_len   = 0,     fixed_len  = 0;
+
+    /* ES loop: stream_type(8) PID(13) ES_info_length(12) descriptors  */
+    for (int i = 12 + info_len; i + 5 <= len - 4; ) {
+        int type   = sec[i];
+        int pid    = ((sec[i + 1] & 0x1F) << 8) | sec[i + 2];
+        int es_len = ((sec[i + 3] & 0x0F) << 8) | sec[i + 4];
+        int d      = i + 5;
+        int d_end  = d + es_len;
+        if (d_end > len - 4) break;
+
+        while (type == 0x06 && d + 2 <= d_end) {
+            int tag  = sec[d];
+            int dlen = sec[d + 1];
+            if (d + 2 + dlen > d_end) break;
+            if (tag == 0x56 || tag == 0x46) {
+                if (!found) {
+                    found    = pid;
+                    desc     = sec + d + 2;
+                    desc_len = dlen;
+                }
+                if (s->pid_fixed && pid == s->pid) {
+                    fixed_desc = sec + d + 2;
+                    fixed_len  = dlen;
+                }
+                break;
+            }
+            d += 2 + dlen;
+        }
+        i = d_end;
+    }
+
+    if (!found) {
+        stream_log(s, "PMT v%d: no teletext stream in program %d",
+                   version, program);
+        return;
+    }
+
+    if (s->pid_fixed) {
+        if (found != s->pid && !fixed_desc)
+            stream_log(s, "PMT v%d lists teletext on PID %d, keeping PID %d",
+                       version, found, s->pid);
+        desc     = fixed_desc;
+        desc_len = fixed_len;
+    } else if (found != s->pid) {
+        stream_log(s, "PMT v%d: teletext PID %d%s", version, found,
+                   s->pid ? " (changed)" : "");
+        stream_set_pid(s, found);
+    }
+
+    int changed = desc && ttx_index_parse(s, desc, desc_len);
+    if (changed)
+        stream_log(s, "PMT v%d: %d teletext page(s) announced",
+                   version, s->nindex);
+    if ((changed || s->pid != old_pid) && s->nindex > 0)
+        ttx_index_publish(s);
+}
+
+/* A complete section has been assembled                               */
+static void psi_section(struct ttx_stream *s, const uint8_t *sec, int len)
+{
+    if (len < 12)                       return;
+    if (!(sec[1] & 0x80))               return;  /* section_syntax    */
+    if (!(sec[5] & 0x01))               return;  /* not yet current   */
+    if (crc32_mpeg(sec, len) != 0)      return;  /* corrupt           */
+
+    if (sec[0] == 0x00)      pat_parse(s, sec, len);
+    else if (sec[0] == 0x02) pmt_parse(s, sec, len);
+}
+
+/* Append TS payload bytes to a section buffer, dispatching every     */
+/* section that completes.  Several sections may share a packet.      */
+static void psi_append(struct ttx_stream *s, struct psi_buf *t,
+                       const uint8_t *p, int n)
+{
+    while (n > 0 && t->started) {
+        if (t->len == 0 && p[0] == 0xFF) {  /* stuffing after sections */
+            t->started = 0;
+            return;
+        }
+
+        int total = 3;
+        if (t->len >= 3)
+            total = 3 + (((t->data[1] & 0x0F) << 8) | t->data[2]);
+        if (total > PSI_MAX_SECTION) { t->started = 0; return; }
+
+        int take = total - t->len;
+        if (take > n) take = n;
+        memcpy(t->data + t->len, p, (size_t)take);
+        t->len += take;
+        p      += take;
+        n      -= take;
+
+        if (t->len >= 3 &&
+            t->len == 3 + (((t->data[1] & 0x0F) << 8) | t->data[2])) {
+            psi_section(s, t->data, t->len);
+            t->len = 0;
+        }
+    }
+}
+
+/* Payload of a PAT or PMT packet.  On payload_unit_start the first   */
+/* byte is pointer_field: the number of bytes that still belong to    */
+/* the previous section before the next one begins.                   */
+static void psi_payload(struct ttx_stream *s, struct psi_buf *t, int pus,
+                        const uint8_t *p, int n)
+{
+    if (pus) {
+        int ptr = p[0];
+        p++; n--;
+        if (ptr > n) { t->started = 0; return; }
+
+        psi_append(s, t, p, ptr);
+        p += ptr;
+        n -= ptr;
+        t->len     = 0;
+        t->started = 1;
+    }
+    psi_append(s, t, p, n);
+}
+
+/* ------------------------------------------------------------------ */
+/* Continuity counter check for one PID (ISO 13818-1 §2.4.3.3).       */
+/* The 4-bit counter advances on every packet with payload; one       */
+/* repeat of the previous packet is allowed and must be ignored.      */
+/* Returns 0 for the expected packet, 1 for a duplicate, -1 when      */
+/* packets were lost in between.                                      */
+/* ------------------------------------------------------------------ */
+static int ts_check_cc(int *last, int cc, int discontinuity)
+{
+    int prev = *last;
+    *last = cc;
+
+    if (prev < 0 || discontinuity)       return 0;
+    if (cc == ((prev + 1) & 0x0F))       return 0;
+    if (cc == prev)                      return 1;
+    return -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Process one 188-byte TS packet                                      */
+static void process_ts_packet(struct ttx_stream *s, const uint8_t *pkt)
+{
+    if (pkt[0] != TS_SYNC_BYTE)    return;
+    if (pkt[1] & 0x80)             return;  /* transport error        */
+
+    int pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+    int psi = (pid == 0 || pid == s->pmt_pid);
+    if (!psi && pid != s->pid)     return;
+
+    int pus            = (pkt[1] >> 6) & 1;  /* payload_unit_start   */
+    int has_adaptation = (pkt[3] & 0x20) != 0;
+    int has_payload    = (pkt[3] & 0x10) != 0;
+
+    if (!has_payload) return;
+
+    int payload_offset = 4;
+    if (has_adaptation) {
+        payload_offset = 5 + pkt[4];
+        if (payload_offset >= TS_PACKET_SIZE) return;
+    }
+
+    const uint8_t *payload     = pkt + payload_offset;
+    int            payload_len = TS_PACKET_SIZE - payload_offset;
+    if (payload_len <= 0) return;
+
+    /* Continuity: drop duplicates; on a gap, abandon whatever was    */
+    /* being assembled rather than splice unrelated bytes together    */
+    int discontinuity = has_adaptation && pkt[4] > 0 && (pkt[5] & 0x80);
+    struct psi_buf *t = psi ? (pid == 0 ? &s->pat : &s->pmt) : NULL;
+    int cc = ts_check_cc(t ? &t->cc : &s->pes_cc, pkt[3] & 0x0F,
+                         discontinuity);
+    if (cc > 0) {
+        s->stats.cc_dups++;
+        return;
+    }
+    if (cc < 0) {
+        s->stats.cc_errors++;
+        if (t) {
+            t->started = 0;             /* resume at next PUSI        */
+        } else {
+            if (s->pes_len > 0) s->stats.pes_dropped++;
+            pes_reset(s);
+            s->pes_wait_pus = 1;
+        }
+    }
+
+    if (t) {
+        psi_payload(s, t, pus, payload, payload_len);
+        return;
+    }
+
+    if (!pus && s->pes_wait_pus) return;
+
+    if (pus) {
+        /* Dispatch whatever PES we have accumulated */
+        if (s->pes_len > 0)
+            dispatch_pes(s);
+
+        pes_reset(s);
+        s->pes_wait_pus = 0;
+
+        /* Read expected PES size from new packet's header */
+        if (payload_len >= 6) {
+            int pes_pkt_len = (payload[4] << 8) | payload[5];
+            /* 0 = unbounded (common for video); for teletext it is set */
+            s->pes_target = (pes_pkt_len > 0) ? 6 + pes_pkt_len : 0;
+        }
+    }
+
+    /* Accumulate payload bytes (by reference) */
+    if (s->pes_len + payload_len <= MAX_PES_SIZE) {
+        pes_add(s, payload, payload_len);
+    } else {
+        stream_log(s, "PES overflow, resetting");
+        pes_reset(s);
+        return;
+    }
+
+    /* Dispatch as soon as PES is complete (bounded PES) */
+    if (s->pes_target > 0 && s->pes_len >= s->pes_target) {
+        dispatch_pes(s);
+        pes_reset(s);
+        s->pes_wait_pus = 1;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* TS resynchronisation                                                */
+/*                                                                     */
+/* If a byte is lost or inserted on the TCP stream, every later packet */
+/* starts at the wrong offset.  Rather than dropping them all until   */
+/* the next reconnect, the stream enters a hunting state: bytes are   */
+/* collected in the carry buffer until TS_RESYNC_COUNT sync bytes are */
+/* found exactly 188 bytes apart, and alignment restarts there.       */
+/* Consumes bytes from data[] and returns how many were used.         */
+/* ------------------------------------------------------------------ */
+static size_t ts_resync(struct ttx_stream *s, const uint8_t *data, size_t len)
+{
+    const int span = (TS_RESYNC_COUNT - 1) * TS_PACKET_SIZE;
+
+    size_t take = (size_t)(TS_RESYNC_WINDOW - s->carry_len);
+    if (take > len) take = len;
+    memcpy(s->carry + s->carry_len, data, take);
+    s->carry_len += (int)take;
+
+    int i;
+    for (i = 0; i + span < s->carry_len; i++) {
+        int k = 0;
+        while (k < TS_RESYNC_COUNT &&
+               s->carry[i + k * TS_PACKET_SIZE] == TS_SYNC_BYTE)
+            k++;
+        if (k == TS_RESYNC_COUNT) break;
+    }
+
+    /* Bytes before i can never start an aligned run: drop them */
+    s->hunt_skipped       += (uint64_t)i;
+    s->stats.resync_bytes += (uint64_t)i;
+    s->carry_len          -= i;
+    memmove(s->carry, s->carry + i, (size_t)s->carry_len);
+
+    if (s->carry_len <= span)
+        return take;                    /* need more data to decide    */
+
+    /* Found: process the aligned packets, keep the partial tail */
+    s->synced = 1;
+    s->stats.resyncs++;
+    stream_log(s, "TS sync regained after skipping %llu bytes (resync #%llu)",
+               (unsigned long long)s->hunt_skipped,
+               (unsigned long long)s->stats.resyncs);
+
+    int off = 0;
+    while (off + TS_PACKET_SIZE <= s->carry_len) {
+        process_ts_packet(s, s->carry + off);
+        off += TS_PACKET_SIZE;
+    }
+    pes_spill(s);                       /* carry is about to move     */
+    s->carry_len -= off;
+    memmove(s->carry, s->carry + off, (size_t)s->carry_len);
+
+    return take;
+}
+
+/* Alignment lost at the packet starting at carry[0] or data[]        */
+static void ts_sync_lost(struct ttx_stream *s)
+{
+    if (s->synced)
+        stream_log(s, "TS sync lost, hunting for 0x47");
+    s->synced       = 0;
+    s->hunt_skipped = 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Process a raw chunk of MPEG-TS bytes, maintaining 188-byte         */
+/* packet alignment across call boundaries via the carry buffer.      */
+/* ------------------------------------------------------------------ */
+static void process_chunk(struct ttx_stream *s, const uint8_t *data, size_t len)
+{
+    size_t offset = 0;
+
+    s->stats.rx_bytes += len;
+
+    while (offset < len) {
+        /* 0. Hunting for sync: nothing is parsed until it is found */
+        if (!s->synced) {
+            offset += ts_resync(s, data + offset, len - offset);
+            continue;
+        }
+
+        /* 1. Drain the carry buffer first */
+        if (s->carry_len > 0) {
+            size_t need = (size_t)(TS_PACKET_SIZE - s->carry_len);
+            size_t take = (len - offset < need) ? len - offset : need;
+            memcpy(s->carry + s->carry_len, data + offset, take);
+            s->carry_len += (int)take;
+            offset       += take;
+
+            if (s->carry_len < TS_PACKET_SIZE)
+                break;
+            if (s->carry[0] != TS_SYNC_BYTE) {
+                ts_sync_lost(s);        /* hunt from the carry bytes   */
+                continue;
+            }
+            process_ts_packet(s, s->carry);
+            pes_spill(s);               /* carry is refilled below     */
+            s->carry_len = 0;
+        }
+
+        /* 2. Process complete packets directly from the buffer, letting */
+        /*    the pre-filter skip everything not on a wanted PID.  Sync   */
+        /*    is checked on the first and last packet of each batch; a   */
+        /*    slip anywhere in between shows up at the end.              */
+        while (offset + TS_PACKET_SIZE <= len) {
+            const uint8_t *p = data + offset;
+            size_t n = (len - offset) / TS_PACKET_SIZE;
+            if (n > TS_FILTER_BATCH) n = TS_FILTER_BATCH;
+
+            size_t good = n;
+            if (p[0] != TS_SYNC_BYTE ||
+                p[(n - 1) * TS_PACKET_SIZE] != TS_SYNC_BYTE) {
+                good = 0;
+                while (p[good * TS_PACKET_SIZE] == TS_SYNC_BYTE) good++;
+            }
+
+            uint64_t hits = good ? g_ts_filter(p, (int)good,
+                                               s->filter_keys,
+                                               s->nfilter) : 0;
+            uint32_t fgen = s->filter_gen;
+            while (hits) {
+                int i = __builtin_ctzll(hits);
+                hits &= hits - 1;
+                process_ts_packet(s, p + (size_t)i * TS_PACKET_SIZE);
+
+                /* A PAT/PMT just changed the wanted PIDs: re-filter the */
+                /* rest of the batch so the PMT or teletext packets      */
+                /* right behind it are not missed                        */
+                if (s->filter_gen != fgen) {
+                    fgen = s->filter_gen;
+                    int next = i + 1;
+                    hits = next < (int)good
+                         ? g_ts_filter(p + (size_t)next * TS_PACKET_SIZE,
+                                       (int)good - next, s->filter_keys,
+                                       s->nfilter) << next
+                         : 0;
+                }
+            }
+            offset += good * TS_PACKET_SIZE;
+
+            if (good < n) {
+                ts_sync_lost(s);
+                break;
+            }
+        }
+        if (!s->synced) continue;
+
+        /* 3. Save any remainder in carry */
+        size_t leftover = len - offset;
+        if (leftover > 0) {
+            memcpy(s->carry, data + offset, leftover);
+            s->carry_len = (int)leftover;
+        }
+        offset = len;
+    }
+
+    /* data[] goes back to the receive thread after this: copy out    */
+    /* whatever PES is still referencing it                            */
+    pes_spill(s);
+}
+
+#ifdef HAVE_ZVBI
+/* ------------------------------------------------------------------ */
+/* Create (or recreate) the libzvbi demux and decoder of a stream     */
+/* ------------------------------------------------------------------ */
+static int zvbi_init(struct ttx_stream *s)
+{
+    if (s->demux) { vbi_dvb_demux_delete(s->demux); s->demux = NULL; }
+    if (s->dec)   { vbi_decoder_delete(s->dec);     s->dec   = NULL; }
+
+    s->demux = vbi_dvb_pes_demux_new(NULL, NULL);
+    if (!s->demux) {
+        fprintf(stderr, "ttxd: vbi_dvb_demux_new failed\n");
+        return 0;
+    }
+
+    s->dec = vbi_decoder_new();
+    if (!s->dec) {
+        fprintf(stderr, "ttxd: vbi_decoder_new failed\n");
+        return 0;
+    }
+
+    if (!vbi_event_handler_add(s->dec, VBI_EVENT_TTX_PAGE,
+                               ttx_event_cb, s)) {
+        fprintf(stderr, "ttxd: vbi_event_handler_add failed\n");
+        return 0;
+    }
+
+    return 1;
+}
+#endif /* HAVE_ZVBI */
+
+/* ------------------------------------------------------------------ */
+/* Start a non-blocking TCP connection to host:port.                  */
+/* Returns fd (connect may still be in progress) or -1 on error.     */
+/* ------------------------------------------------------------------ */
+static int tcp_connect(const char *host, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("ttxd: socket"); return -1; }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons((uint16_t)port);
+
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "ttxd: invalid address: %s\n", host);
+        close(fd);
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+        errno != EINPROGRESS) {
+        fprintf(stderr, "ttxd: connect %s:%d: %s\n",
+                host, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* ------------------------------------------------------------------ */
+/* Send HTTP/1.1 GET request for the stream.                          */
+/* ------------------------------------------------------------------ */
+static int http_request(int fd, const char *host, int port, int channel)
+{
+    char req[256];
+    int  len = snprintf(req, sizeof(req),
+                        "GET /auto/v%d HTTP/1.1\r\n"
+                        "Host: %s:%d\r\n"
+                        "Connection: close\r\n"
+                        "\r\n",
+                        channel, host, port);
+
+    ssize_t sent = send(fd, req, (size_t)len, 0);
+    if (sent != (ssize_t)len) {
+        fprintf(stderr, "ttxd: http_request send: %s\n", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Check a (partial) HTTP response held in buf[0..len).               */
+/* Returns the header length including the terminating \r\n\r\n once  */
+/* it is present, 0 if more bytes are needed, -1 on a non-200 status. */
+/* ------------------------------------------------------------------ */
+static int http_parse_response(const struct ttx_stream *s,
+                               const char *buf, int len)
+{
+    const char *eol = memchr(buf, '\n', (size_t)len);
+    if (!eol) return 0;                 /* status line incomplete     */
+
+    /* Status line: "HTTP/1.x 200 OK" — look for the 200 before \r\n  */
+    int  slen = (int)(eol - buf);
+    char status[128];
+    if (slen >= (int)sizeof(status)) slen = (int)sizeof(status) - 1;
+    memcpy(status, buf, (size_t)slen);
+    status[slen] = '\0';
+
+    if (!strstr(status, " 200")) {
+        char *p = strpbrk(status, "\r\n");
+        if (p) *p = '\0';
+        stream_log(s, "HTTP error: %s", status);
+        return -1;
+    }
+
+    for (int i = 0; i + 3 < len; i++) {
+        if (buf[i] == '\r' && buf[i+1] == '\n' &&
+            buf[i+2] == '\r' && buf[i+3] == '\n')
+            return i + 4;
+    }
+    return 0;
+}
+
+#ifdef HAVE_IO_URING
+/* ------------------------------------------------------------------ */
+/* io_uring receive backend (--io-uring)                               */
+/*                                                                     */
+/* Each streaming socket gets one multishot IORING_OP_RECV that picks */
+/* buffers from a provided buffer ring shared by all streams.  The    */
+/* kernel writes TS bytes straight into those buffers and the demux   */
+/* thread parses them in place; the buffer is handed back to the ring */
+/* when its chunk returns.  At most PIPE_RX_CHUNKS buffers are out at */
+/* once, so the kernel never runs dry.  The ring fd is itself         */
+/* registered with epoll, so connection setup keeps using the         */
+/* ordinary state machine.                                             */
+/* ------------------------------------------------------------------ */
+struct uring {
+    struct ev_handler         ev;       /* must be first               */
+    int                       fd;
+
+    unsigned                 *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe      *sqes;
+    unsigned                  sq_entries;
+    unsigned                  to_submit;
+
+    unsigned                 *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe      *cqes;
+
+    struct io_uring_buf_ring *br;       /* provided buffer ring        */
+    uint8_t                  *bufs;     /* URING_BUF_COUNT × SIZE      */
+    uint16_t                  br_tail;
+};
+
+static struct uring g_uring = { .fd = -1 };
+
+/* Make buffer bid available to the kernel again                      */
+static void uring_buf_recycle(struct uring *u, unsigned bid)
+{
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUF_COUNT - 1)];
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+    b->len  = URING_BUF_SIZE;
+    b->bid  = (uint16_t)bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_submit(struct uring *u)
+{
+    while (u->to_submit > 0) {
+        int n = (int)syscall(__NR_io_uring_enter, u->fd, u->to_submit,
+                             0, 0, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ttxd: io_uring_enter: %s\n", strerror(errno));
+            return 0;
+        }
+        u->to_submit -= (unsigned)n;
+    }
+    return 1;
+}
+
+/* Arm a multishot recv on a streaming socket.  user_data carries the  */
+/* stream index and its connection generation, so completions that    */
+/* belong to an earlier connection can be recognised and dropped.     */
+static int uring_recv(struct ttx_stream *s, int index)
+{
+    struct uring *u    = &g_uring;
+    unsigned      tail = *u->sq_tail;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+        return 0;                       /* SQ full, cannot happen with */
+                                        /* one SQE per stream          */
+    unsigned             idx = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = s->fd;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = (uint64_t)(uint32_t)index | ((uint64_t)s->gen << 32);
+
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+
+    return uring_submit(u);
+}
+
+/* Set up the ring, the provided buffers and the epoll registration.  */
+/* Returns 0 if io_uring is unusable here (old kernel, seccomp, ...). */
+static int uring_init(void (*on_cqe)(struct ev_handler *, uint32_t))
+{
+    struct uring           *u = &g_uring;
+    struct io_uring_params  p;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (u->fd < 0) {
+        fprintf(stderr, "ttxd: io_uring_setup: %s\n", strerror(errno));
+        return 0;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        fprintf(stderr, "ttxd: io_uring: kernel too old\n");
+        goto fail;
+    }
+
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_sz = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t rsz   = sq_sz > cq_sz ? sq_sz : cq_sz;
+
+    uint8_t *ring = mmap(NULL, rsz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        perror("ttxd: io_uring mmap");
+        goto fail;
+    }
+
+    u->sq_head    = (unsigned *)(ring + p.sq_off.head);
+    u->sq_tail    = (unsigned *)(ring + p.sq_off.tail);
+    u->sq_mask    = (unsigned *)(ring + p.sq_off.ring_mask);
+    u->sq_array   = (unsigned *)(ring + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head    = (unsigned *)(ring + p.cq_off.head);
+    u->cq_tail    = (unsigned *)(ring + p.cq_off.tail);
+    u->cq_mask    = (unsigned *)(ring + p.cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+    /* Provided buffer ring: the ring itself must be page aligned */
+    size_t br_sz = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    u->br   = mmap(NULL, br_sz, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (u->br == MAP_FAILED || !u->bufs) {
+        perror("ttxd: io_uring buffers");
+        goto fail;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid         = 0;
+    if (syscall(__NR_io_uring_register, u->fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        fprintf(stderr, "ttxd: io_uring buffer ring: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    u->br_tail = 0;
+    for (unsigned i = 0; i < URING_BUF_COUNT; i++)
+        uring_buf_recycle(u, i);
+
+    /* The ring fd polls readable whenever completions are waiting */
+    u->ev.fn = on_cqe;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &u->ev };
+    if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, u->fd, &ev) < 0) {
+        perror("ttxd: epoll_ctl io_uring");
+        goto fail;
+    }
+
+    return 1;
+
+fail:
+    close(u->fd);               /* mappings are left for process exit */
+    u->fd = -1;
+    return 0;
+}
+#endif /* HAVE_IO_URING */
+
+/* Demux thread: forget everything about the previous connection,    */
+/* so the next one starts with a clean demux and decoder              */
+static void stream_reset(struct ttx_stream *s)
+{
+    s->carry_len  = 0;
+    s->synced     = 1;                  /* HDHomeRun starts aligned   */
+
+    /* Re-learn PAT/PMT; an auto PID is re-discovered from the PMT */
+    s->pat.started   = 0;
+    s->pmt.started   = 0;
+    s->pat.cc        = -1;
+    s->pmt.cc        = -1;
+    s->pmt_pid       = 0;
+    s->pat_version   = -1;
+    s->pmt_version   = -1;
+    s->nindex        = 0;
+    if (!s->pid_fixed) s->pid = 0;
+    stream_set_filter(s);
+    pes_reset(s);
+    s->pes_cc       = -1;
+    s->pes_wait_pus = 1;                /* joined mid-PES             */
+    s->pts          = -1;
+
+    /* Recreate demuxer so its internal state is clean */
+#ifdef HAVE_ZVBI
+    s->decoding = g_native ? native_init(s) : zvbi_init(s);
+#else
+    s->decoding = native_init(s);
+#endif
+    if (!s->decoding)
+        stream_log(s, "decoder init failed, stream not decoded");
+}
+
+/* ------------------------------------------------------------------ */
+/* Receive side of the pipeline                                        */
+/* ------------------------------------------------------------------ */
+
+/* Move chunks the demux has finished with back to the idle list,    */
+/* giving io_uring buffers back to the kernel                          */
+static void rx_reclaim(void)
+{
+    struct rx_chunk *c;
+
+    while ((c = spsc_pop(&g_pipe.rx_free)) != NULL) {
+#ifdef HAVE_IO_URING
+        if (c->bid >= 0) uring_buf_recycle(&g_uring, (unsigned)c->bid);
+#endif
+        c->bid  = -1;
+        c->next = g_pipe.rx_idle;
+        g_pipe.rx_idle = c;
+    }
+}
+
+/* An idle chunk, waiting for the demux to return one if all are in   */
+/* flight.  With own set it comes with its own receive buffer.        */
+/* NULL when shutting down or out of memory.                           */
+static struct rx_chunk *rx_chunk_get(int own)
+{
+    struct rx_chunk *c;
+
+    for (;;) {
+        rx_reclaim();
+        if ((c = g_pipe.rx_idle) != NULL) {
+            g_pipe.rx_idle = c->next;
+            break;
+        }
+        if (g_pipe.rx_count < PIPE_RX_CHUNKS &&
+            (c = calloc(1, sizeof(*c))) != NULL) {
+            c->bid = -1;
+            g_pipe.rx_count++;
+            break;
+        }
+        if (!g_running || g_pipe.rx_count == 0) return NULL;
+        spsc_sleep(&g_pipe.rx_free, -1, 1000);
+    }
+
+    if (own && !c->own && !(c->own = malloc(RECV_BUF_SIZE))) {
+        c->next = g_pipe.rx_idle;
+        g_pipe.rx_idle = c;
+        return NULL;
     }
+    return c;
+}
+
+/* Pass a chunk to the demux thread, which now owns it                */
+static void rx_post(struct ttx_stream *s, struct rx_chunk *c, int op,
+                    const uint8_t *data, int len)
+{
+    c->s    = s;
+    c->op   = op;
+    c->data = data;
+    c->len  = len;
+    if (op == RX_DATA) s->rx_dirty = 1;
+    spsc_push(&g_pipe.rx, c);
 }
 
 /* ------------------------------------------------------------------ */
-/* Create (or recreate) the libzvbi demux and decoder                 */
+/* Stream connection state machine                                     */
 /* ------------------------------------------------------------------ */
-static int zvbi_init(void)
+
+/* Drop the connection and schedule a reconnect.  The demux is told   */
+/* to reset once the data already queued for it has been parsed.     */
+static void stream_fail(struct ttx_stream *s, const char *why)
 {
-    if (g_demux) { vbi_dvb_demux_delete(g_demux); g_demux = NULL; }
-    if (g_dec)   { vbi_decoder_delete(g_dec);     g_dec   = NULL; }
+    if (s->fd >= 0) { close(s->fd); s->fd = -1; }  /* leaves epoll too */
+    free(s->hdr);
+    s->hdr      = NULL;
+    s->state    = ST_IDLE;
+    s->deadline = time(NULL) + RECONNECT_DELAY;
 
-    g_demux = vbi_dvb_pes_demux_new(NULL, NULL);
-    if (!g_demux) {
-        fprintf(stderr, "ttxd: vbi_dvb_demux_new failed\n");
-        return 0;
+    if (s->rx_dirty) {
+        struct rx_chunk *c = rx_chunk_get(0);
+        if (c) {
+            rx_post(s, c, RX_RESET, NULL, 0);
+            s->rx_dirty = 0;
+        }
     }
 
-    g_dec = vbi_decoder_new();
-    if (!g_dec) {
-        fprintf(stderr, "ttxd: vbi_decoder_new failed\n");
-        return 0;
+    if (g_running)
+        stream_log(s, "%s — retrying in %ds", why, RECONNECT_DELAY);
+}
+
+/* Begin a new connection attempt                                      */
+static void stream_connect(struct ttx_stream *s)
+{
+    s->hdr = malloc(HTTP_HDR_MAX);
+    s->hdr_len = 0;
+    s->fd = s->hdr ? tcp_connect(s->host, s->port) : -1;
+    if (s->fd < 0) { stream_fail(s, "connect failed"); return; }
+    s->gen++;
+
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = &s->ev };
+    if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0) {
+        stream_fail(s, "epoll_ctl failed");
+        return;
     }
 
-    if (!vbi_event_handler_add(g_dec, VBI_EVENT_TTX_PAGE,
-                               ttx_event_cb, NULL)) {
-        fprintf(stderr, "ttxd: vbi_event_handler_add failed\n");
-        return 0;
+    s->state    = ST_CONNECTING;
+    s->deadline = time(NULL) + HTTP_TIMEOUT;
+}
+
+/* Socket became writable: connect() finished, send the GET request    */
+static void stream_on_connected(struct ttx_stream *s)
+{
+    int       err = 0;
+    socklen_t elen = sizeof(err);
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &elen) < 0 || err) {
+        stream_log(s, "connect: %s", strerror(err ? err : errno));
+        stream_fail(s, "connect failed");
+        return;
     }
 
-    return 1;
+    if (!http_request(s->fd, s->host, s->port, s->channel)) {
+        stream_fail(s, "request failed");
+        return;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &s->ev };
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, s->fd, &ev);
+    s->state = ST_HEADERS;
+}
+
+/* Readable while waiting for headers: accumulate and parse them.     */
+/* Any MPEG-TS bytes that arrived in the same recv() as the end of    */
+/* the headers are passed straight on to the demux.                   */
+static void stream_on_headers(struct ttx_stream *s)
+{
+    ssize_t n = recv(s->fd, s->hdr + s->hdr_len,
+                     HTTP_HDR_MAX - (size_t)s->hdr_len, 0);
+    if (n <= 0) {
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        stream_log(s, "recv during headers: %s",
+                   n < 0 ? strerror(errno) : "connection closed");
+        stream_fail(s, "no response");
+        return;
+    }
+    s->hdr_len += (int)n;
+
+    int hlen = http_parse_response(s, s->hdr, s->hdr_len);
+    if (hlen < 0) { stream_fail(s, "bad response"); return; }
+    if (hlen == 0) {
+        if (s->hdr_len >= HTTP_HDR_MAX)
+            stream_fail(s, "HTTP header too large");
+        return;
+    }
+
+    stream_log(s, "connected, receiving stream");
+    s->state = ST_STREAMING;
+
+    if (s->hdr_len > hlen) {
+        struct rx_chunk *c = rx_chunk_get(1);
+        if (c) {
+            memcpy(c->own, s->hdr + hlen, (size_t)(s->hdr_len - hlen));
+            rx_post(s, c, RX_DATA, c->own, s->hdr_len - hlen);
+        }
+    }
+    free(s->hdr);
+    s->hdr = NULL;
+
+#ifdef HAVE_IO_URING
+    /* Hand the socket over to io_uring; epoll no longer watches it   */
+    if (g_use_uring) {
+        epoll_ctl(g_epfd, EPOLL_CTL_DEL, s->fd, NULL);
+        if (!uring_recv(s, (int)(s - g_streams)))
+            stream_fail(s, "io_uring recv failed");
+    }
+#endif
+}
+
+/* Readable while streaming: one recv() per wakeup keeps the streams  */
+/* fair — epoll is level-triggered, so remaining data is picked up on */
+/* the next pass.  Each recv() fills a chunk that goes to the demux.  */
+static void stream_on_data(struct ttx_stream *s)
+{
+    struct rx_chunk *c = rx_chunk_get(1);
+    if (!c) return;
+
+    ssize_t n = recv(s->fd, c->own, RECV_BUF_SIZE, 0);
+    if (n <= 0) {
+        c->next = g_pipe.rx_idle;
+        g_pipe.rx_idle = c;
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        stream_fail(s, "stream ended");
+        return;
+    }
+    rx_post(s, c, RX_DATA, c->own, (int)n);
+}
+
+static void stream_event(struct ev_handler *h, uint32_t events)
+{
+    struct ttx_stream *s = (struct ttx_stream *)h;
+
+    switch (s->state) {
+    case ST_CONNECTING:
+        stream_on_connected(s);
+        break;
+    case ST_HEADERS:
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            stream_on_headers(s);
+        break;
+    case ST_STREAMING:
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            stream_on_data(s);
+        break;
+    case ST_IDLE:
+        break;
+    }
 }
 
+#ifdef HAVE_IO_URING
 /* ------------------------------------------------------------------ */
-/* Open a TCP connection to host:port.  Returns fd or -1 on error.   */
+/* io_uring ring fd readable: drain the completion queue              */
 /* ------------------------------------------------------------------ */
-static int tcp_connect(const char *host, int port)
+static void uring_event(struct ev_handler *h, uint32_t events)
 {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) { perror("ttxd: socket"); return -1; }
+    struct uring *u    = (struct uring *)h;
+    unsigned      head = *u->cq_head;
+    (void)events;
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port   = htons((uint16_t)port);
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        struct ttx_stream   *s   = &g_streams[(uint32_t)cqe->user_data];
+        uint32_t             gen = (uint32_t)(cqe->user_data >> 32);
+        int                  res = cqe->res;
+        unsigned             flg = cqe->flags;
+        int                  cur = (gen == s->gen && s->state == ST_STREAMING);
 
-    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
-        fprintf(stderr, "ttxd: invalid address: %s\n", host);
-        close(fd);
-        return -1;
+        if (flg & IORING_CQE_F_BUFFER) {
+            unsigned         bid = flg >> IORING_CQE_BUFFER_SHIFT;
+            struct rx_chunk *c   = (cur && res > 0) ? rx_chunk_get(0) : NULL;
+
+            /* The buffer travels with the chunk and is recycled when */
+            /* the demux gives the chunk back                          */
+            if (c) {
+                c->bid = (int)bid;
+                rx_post(s, c, RX_DATA,
+                        u->bufs + (size_t)bid * URING_BUF_SIZE, res);
+            } else {
+                uring_buf_recycle(u, bid);
+            }
+        }
+
+        head++;
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+        /* Multishot recv stays armed while F_MORE is set.  It ends on  */
+        /* EOF, on error, or when the buffer ring briefly ran dry —    */
+        /* only the last case is worth re-arming.                      */
+        if (!cur || (flg & IORING_CQE_F_MORE))
+            continue;
+        if (res == -ENOBUFS) {
+            if (uring_recv(s, (int)(s - g_streams)))
+                continue;
+        }
+        stream_fail(s, res < 0 ? strerror(-res) : "stream ended");
     }
+}
+#endif /* HAVE_IO_URING */
 
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        fprintf(stderr, "ttxd: connect %s:%d: %s\n",
-                host, port, strerror(errno));
-        close(fd);
-        return -1;
+/* Reconnect idle streams and time out stalled connection attempts.   */
+/* Returns the epoll timeout in ms until the next deadline.           */
+static int stream_timers(void)
+{
+    time_t now  = time(NULL);
+    time_t next = now + 1;  /* also bounds signal-to-exit latency     */
+
+    for (int i = 0; i < g_nstreams; i++) {
+        struct ttx_stream *s = &g_streams[i];
+
+        if (s->state == ST_IDLE && now >= s->deadline)
+            stream_connect(s);
+        else if ((s->state == ST_CONNECTING || s->state == ST_HEADERS) &&
+                 now >= s->deadline)
+            stream_fail(s, "HTTP timeout");
+
+        if (s->state != ST_STREAMING && s->deadline < next)
+            next = s->deadline;
     }
 
-    return fd;
+    return next > now ? (int)(next - now) * 1000 : 0;
 }
 
 /* ------------------------------------------------------------------ */
-/* Send HTTP/1.1 GET request for the stream.                          */
+/* Log every stream's counters (--stats)                               */
 /* ------------------------------------------------------------------ */
-static int http_request(int fd, const char *host, int port, int channel)
+static void stats_report(void)
 {
-    char req[256];
-    int  len = snprintf(req, sizeof(req),
-                        "GET /auto/v%d HTTP/1.1\r\n"
-                        "Host: %s:%d\r\n"
-                        "Connection: close\r\n"
-                        "\r\n",
-                        channel, host, port);
+    for (int i = 0; i < g_nstreams; i++) {
+        const struct ttx_stream *s  = &g_streams[i];
+        const struct ttx_stats  *st = &s->stats;
 
-    ssize_t sent = send(fd, req, (size_t)len, 0);
-    if (sent != (ssize_t)len) {
-        fprintf(stderr, "ttxd: http_request send: %s\n", strerror(errno));
+        stream_log(s, "stats: rx_bytes=%llu resyncs=%llu resync_bytes=%llu"
+                   " cc_errors=%llu cc_dups=%llu pes_dropped=%llu"
+                   " pes_copied=%llu ham_errors=%llu pages_unchanged=%llu",
+                   (unsigned long long)st->rx_bytes,
+                   (unsigned long long)st->resyncs,
+                   (unsigned long long)st->resync_bytes,
+                   (unsigned long long)st->cc_errors,
+                   (unsigned long long)st->cc_dups,
+                   (unsigned long long)st->pes_dropped,
+                   (unsigned long long)st->pes_copied,
+                   (unsigned long long)st->ham_errors,
+                   (unsigned long long)__atomic_load_n(&st->pages_unchanged,
+                                                       __ATOMIC_RELAXED));
+    }
+
+    const struct spsc_ring *r[4] = { &g_pipe.rx, &g_pipe.rx_free,
+                                     &g_pipe.out, &g_pipe.out_free };
+    char line[256];
+    int  pos = 0;
+    for (int i = 0; i < 4; i++)
+        pos += snprintf(line + pos, sizeof(line) - pos, " %s=%u/%d",
+                        r[i]->name,
+                        __atomic_load_n(&r[i]->high_water, __ATOMIC_RELAXED),
+                        PIPE_RING_SIZE);
+    fprintf(stderr, "ttxd: ring high-water:%s\n", line);
+
+    if (g_batch.max) {
+        uint64_t calls = __atomic_load_n(&g_batch.calls, __ATOMIC_RELAXED);
+        uint64_t sent  = __atomic_load_n(&g_batch.sent, __ATOMIC_RELAXED);
+        fprintf(stderr, "ttxd: udp batches: calls=%llu datagrams=%llu"
+                " avg=%.1f max=%u syscalls_saved=%llu\n",
+                (unsigned long long)calls, (unsigned long long)sent,
+                calls ? (double)sent / (double)calls : 0.0,
+                __atomic_load_n(&g_batch.largest, __ATOMIC_RELAXED),
+                (unsigned long long)(sent - calls));
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Demux/decode thread: parse what the receive thread queued, run the */
+/* decoders, merge magazine workers, and look after the timers that   */
+/* concern decoder state                                               */
+/* ------------------------------------------------------------------ */
+static void demux_timers(time_t *stats_next)
+{
+    time_t now = time(NULL);
+
+    /* Repeat the page index for consumers that started late */
+    for (int i = 0; i < g_nstreams; i++) {
+        struct ttx_stream *s = &g_streams[i];
+        if (s->nindex > 0 && now >= s->index_next)
+            ttx_index_publish(s);
+    }
+
+    if (g_stats_interval > 0 && now >= *stats_next) {
+        stats_report();
+        *stats_next = now + g_stats_interval;
+    }
+}
+
+static void *demux_main(void *arg)
+{
+    time_t stats_next = time(NULL) + g_stats_interval;
+    (void)arg;
+
+    for (;;) {
+        /* Read the flag first: anything queued before it was set is */
+        /* then visible to the pop below                              */
+        int              stopping = __atomic_load_n(&g_pipe.stop,
+                                                    __ATOMIC_ACQUIRE);
+        struct rx_chunk *c        = spsc_pop(&g_pipe.rx);
+
+        if (c) {
+            if (c->op == RX_RESET)
+                stream_reset(c->s);
+            else
+                process_chunk(c->s, c->data, (size_t)c->len);
+            spsc_push(&g_pipe.rx_free, c);
+        }
+        if (g_mag.n > 0)
+            mag_poll();
+        demux_timers(&stats_next);
+
+        if (!c) {
+            if (stopping) break;
+            spsc_sleep(&g_pipe.rx, g_mag.efd, 1000);
+        }
+    }
+
+    /* Pages the workers still finish go out before the output stops */
+    mag_pool_stop();
+
+    uint64_t one = 1;
+    ssize_t  n;
+    __atomic_store_n(&g_pipe.out_stop, 1, __ATOMIC_RELEASE);
+    n = write(g_pipe.out.efd, &one, sizeof(one));
+    (void)n;
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Output thread: format pages and send every datagram                */
+/* ------------------------------------------------------------------ */
+static void *output_main(void *arg)
+{
+    unsigned handled = 0;
+    (void)arg;
+
+    for (;;) {
+        int             stopping = __atomic_load_n(&g_pipe.out_stop,
+                                                   __ATOMIC_ACQUIRE);
+        struct out_msg *m        = spsc_pop(&g_pipe.out);
+
+        if (!m) {
+            if (stopping) break;
+            spsc_sleep(&g_pipe.out, g_out_epfd, udp_batch_timer());
+            if (g_out_epfd >= 0)
+                out_poll();
+            continue;
+        }
+
+        if (m->len == 0)
+            page_output(m->s, &m->u.page);
+        else
+            udp_send(m->s, m->u.raw, m->len);
+        spsc_push(&g_pipe.out_free, m);
+
+        /* With no window, a batch waits only while pages are queued */
+        if (g_batch.n && g_batch.window_ms)
+            udp_batch_timer();
+
+        /* Sockets are served between pages while a backlog lasts    */
+        if (g_out_epfd >= 0 && ++handled % 64 == 0)
+            out_poll();
+    }
+    udp_flush();
+    return NULL;
+}
+
+/* Create the rings and start the demux and output threads            */
+static int pipe_start(void)
+{
+    g_pipe.rx.efd = g_pipe.rx_free.efd = -1;
+    g_pipe.out.efd = g_pipe.out_free.efd = -1;
+    if (!spsc_init(&g_pipe.rx,       "rx")       ||
+        !spsc_init(&g_pipe.rx_free,  "rx_free")  ||
+        !spsc_init(&g_pipe.out,      "out")      ||
+        !spsc_init(&g_pipe.out_free, "out_free"))
+        return 0;
+
+    if (pthread_create(&g_pipe.output, NULL, output_main, NULL) != 0) {
+        fprintf(stderr, "ttxd: cannot start output thread\n");
+        return 0;
+    }
+    if (pthread_create(&g_pipe.demux, NULL, demux_main, NULL) != 0) {
+        fprintf(stderr, "ttxd: cannot start demux thread\n");
+        __atomic_store_n(&g_pipe.out_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(g_pipe.output, NULL);
+        return 0;
+    }
+    return 1;
+}
+
+/* Let the demux and output threads drain their rings, then join them */
+static void pipe_stop(void)
+{
+    uint64_t one = 1;
+    ssize_t  n;
+
+    __atomic_store_n(&g_pipe.stop, 1, __ATOMIC_RELEASE);
+    n = write(g_pipe.rx.efd, &one, sizeof(one));
+    (void)n;
+    pthread_join(g_pipe.demux, NULL);
+    pthread_join(g_pipe.output, NULL);
+}
+
+/* Free the chunks and messages once every thread has stopped         */
+static void pipe_free(void)
+{
+    struct spsc_ring *r[4] = { &g_pipe.rx, &g_pipe.rx_free,
+                               &g_pipe.out, &g_pipe.out_free };
+
+    rx_reclaim();
+    while (g_pipe.rx_idle) {
+        struct rx_chunk *c = g_pipe.rx_idle;
+        g_pipe.rx_idle = c->next;
+        free(c->own);
+        free(c);
+    }
+    void *m;
+    while ((m = spsc_pop(&g_pipe.out_free)) != NULL) free(m);
+    while (g_pipe.out_idle) {
+        struct out_msg *o = g_pipe.out_idle;
+        g_pipe.out_idle = o->next;
+        free(o);
+    }
+    for (int i = 0; i < 4; i++)
+        if (r[i]->efd >= 0) close(r[i]->efd);
+}
+
+/* One output address: "<port>" (127.0.0.1), "<ipv4>:<port>" or       */
+/* "[<ipv6>]:<port>".  Link-local IPv6 goes out on --mcast-if.        */
+static int udp_dest_parse(const char *spec, struct udp_dest *d)
+{
+    char        host[48] = "127.0.0.1";
+    const char *port = spec;
+    const char *sep;
+
+    memset(d, 0, sizeof(*d));
+    if (spec[0] == '[') {
+        sep = strchr(spec, ']');
+        if (!sep || sep[1] != ':' || sep - spec - 1 >= (ptrdiff_t)sizeof(host))
+            return 0;
+        snprintf(host, sizeof(host), "%.*s", (int)(sep - spec - 1), spec + 1);
+        port = sep + 2;
+    } else if ((sep = strchr(spec, ':')) != NULL) {
+        if (sep - spec >= (ptrdiff_t)sizeof(host))
+            return 0;
+        snprintf(host, sizeof(host), "%.*s", (int)(sep - spec), spec);
+        port = sep + 1;
+    }
+
+    char *end;
+    long  pn = strtol(port, &end, 10);
+    if (end == port || *end || pn <= 0 || pn > 65535)
         return 0;
+
+    if (spec[0] == '[') {
+        struct sockaddr_in6 *a = (struct sockaddr_in6 *)&d->addr;
+        a->sin6_family = AF_INET6;
+        a->sin6_port   = htons((uint16_t)pn);
+        if (inet_pton(AF_INET6, host, &a->sin6_addr) != 1)
+            return 0;
+        if (IN6_IS_ADDR_LINKLOCAL(&a->sin6_addr) ||
+            IN6_IS_ADDR_MC_LINKLOCAL(&a->sin6_addr))
+            a->sin6_scope_id = g_mcast_if;
+        d->len = sizeof(*a);
+    } else {
+        struct sockaddr_in *a = (struct sockaddr_in *)&d->addr;
+        a->sin_family = AF_INET;
+        a->sin_port   = htons((uint16_t)pn);
+        if (inet_pton(AF_INET, host, &a->sin_addr) != 1)
+            return 0;
+        d->len = sizeof(*a);
     }
     return 1;
 }
 
+/* " udp://addr:port" for the start-up log                            */
+static int udp_dest_format(const struct udp_dest *d, char *buf, size_t size)
+{
+    char host[INET6_ADDRSTRLEN];
+    int  v6 = d->addr.ss_family == AF_INET6;
+
+    if (v6)
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)&d->addr)->sin6_addr,
+                  host, sizeof(host));
+    else
+        inet_ntop(AF_INET, &((const struct sockaddr_in *)&d->addr)->sin_addr,
+                  host, sizeof(host));
+    return snprintf(buf, size, v6 ? " udp://[%s]:%d" : " udp://%s:%d",
+                    host, udp_dest_port(d));
+}
+
 /* ------------------------------------------------------------------ */
-/* Read and discard the HTTP response headers.                        */
-/* Returns 1 on success (200 OK, headers consumed), 0 on error.      */
-/* Uses a 4-byte sliding window to detect the \r\n\r\n boundary.     */
+/* Parse one <hdhomerun-ip>[:<port>] <channel> <pid> <udp-port> tuple */
 /* ------------------------------------------------------------------ */
-static int http_skip_headers(int fd)
+static int stream_parse(struct ttx_stream *s, char **argv)
 {
-    /* Read the status line first to check for 200 */
-    char status[128];
-    int  slen = 0;
-    while (slen < (int)sizeof(status) - 1) {
-        char c;
-        ssize_t n = recv(fd, &c, 1, 0);
-        if (n <= 0) {
-            fprintf(stderr, "ttxd: recv during status line: %s\n",
-                    n < 0 ? strerror(errno) : "connection closed");
+    memset(s, 0, sizeof(*s));
+    s->ev.fn = stream_event;
+    s->fd    = -1;
+    s->port  = HDHOMERUN_PORT;
+
+    char *colon = strchr(argv[0], ':');
+    if (colon) {
+        size_t hlen = (size_t)(colon - argv[0]);
+        if (hlen == 0 || hlen >= sizeof(s->host)) {
+            fprintf(stderr, "ttxd: invalid host argument\n");
             return 0;
         }
-        status[slen++] = c;
-        if (slen >= 2 && status[slen-2] == '\r' && status[slen-1] == '\n')
-            break;
+        memcpy(s->host, argv[0], hlen);
+        s->host[hlen] = '\0';
+        s->port       = atoi(colon + 1);
+    } else {
+        strncpy(s->host, argv[0], sizeof(s->host) - 1);
+        s->host[sizeof(s->host) - 1] = '\0';
     }
-    status[slen] = '\0';
 
-    if (!strstr(status, "200")) {
-        /* Trim trailing \r\n for clean logging */
-        char *p = strpbrk(status, "\r\n");
-        if (p) *p = '\0';
-        fprintf(stderr, "ttxd: HTTP error: %s\n", status);
+    s->channel   = atoi(argv[1]);
+    s->pid       = strcmp(argv[2], "auto") == 0 ? 0 : atoi(argv[2]);
+    s->pid_fixed = s->pid != 0;
+    if (s->pid < 0 || s->pid > 8191 ||
+        (s->pid == 0 && strcmp(argv[2], "auto") != 0 &&
+         strcmp(argv[2], "0") != 0)) {
+        fprintf(stderr, "ttxd: invalid PID %d\n", s->pid);
+        return 0;
+    }
+    if (s->port <= 0 || s->port > 65535) {
+        fprintf(stderr, "ttxd: invalid stream port %d\n", s->port);
         return 0;
     }
 
-    /* Consume remaining headers until \r\n\r\n */
-    int   total   = 0;
-    char  window[4] = {0, 0, 0, 0};
+    char dests[UDP_DEST_MAX * 56] = "";
+    int  dpos = 0;
+    for (const char *p = argv[3]; ; p++) {
+        const char *comma = strchr(p, ',');
+        char        spec[64];
 
-    while (total < HTTP_HDR_MAX) {
-        char c;
-        ssize_t n = recv(fd, &c, 1, 0);
-        if (n <= 0) {
-            fprintf(stderr, "ttxd: recv during headers: %s\n",
-                    n < 0 ? strerror(errno) : "connection closed");
+        snprintf(spec, sizeof(spec), "%.*s",
+                 (int)(comma ? comma - p : (ptrdiff_t)strlen(p)), p);
+        if (s->ndest == UDP_DEST_MAX) {
+            fprintf(stderr, "ttxd: at most %d UDP destinations per stream\n",
+                    UDP_DEST_MAX);
+            return 0;
+        }
+        if (!udp_dest_parse(spec, &s->dest[s->ndest])) {
+            fprintf(stderr, "ttxd: invalid UDP destination %s\n", spec);
             return 0;
         }
-        window[0] = window[1];
-        window[1] = window[2];
-        window[2] = window[3];
-        window[3] = c;
-        total++;
-        if (window[0] == '\r' && window[1] == '\n' &&
-            window[2] == '\r' && window[3] == '\n')
-            return 1;   /* headers done */
+        dpos += udp_dest_format(&s->dest[s->ndest++], dests + dpos,
+                                sizeof(dests) - (size_t)dpos);
+        if (!comma) break;
+        p = comma;
     }
 
-    fprintf(stderr, "ttxd: HTTP header too large\n");
-    return 0;
+    char pid_str[16];
+    if (s->pid_fixed) snprintf(pid_str, sizeof(pid_str), "%d", s->pid);
+    else              strcpy(pid_str, "auto");
+
+    fprintf(stderr,
+            "ttxd: stream=http://%s:%d/auto/v%d  PID=%s  →%s\n",
+            s->host, s->port, s->channel, pid_str, dests);
+    return 1;
 }
 
 /* ------------------------------------------------------------------ */
-int main(int argc, char *argv[])
+static void usage(const char *prog)
 {
-    if (argc != 5) {
-        fprintf(stderr,
-            "Usage: %s <hdhomerun-ip>[:<port>] <channel> <teletext-pid> <udp-port>\n"
-            "\n"
-            "  hdhomerun-ip  IP of the HDHomeRun device (port defaults to %d)\n"
-            "  channel       Channel number (e.g. 1)\n"
-            "  teletext-pid  Teletext PID in decimal (e.g. 7013)\n"
-            "                Find with: ffprobe http://<ip>:%d/auto/v<ch> 2>&1"
-            " | grep teletext\n"
-            "  udp-port      UDP port to send JSON to on 127.0.0.1"
-            " (e.g. 5555)\n",
-            argv[0], HDHOMERUN_PORT, HDHOMERUN_PORT);
-        return 1;
-    }
+    fprintf(stderr,
+        "Usage: %s [options] <hdhomerun-ip>[:<port>] <channel> <teletext-pid> <udp-port> [...]\n"
+        "\n"
+        "  hdhomerun-ip  IP of the HDHomeRun device (port defaults to %d)\n"
+        "  channel       Channel number (e.g. 1)\n"
+        "  teletext-pid  Teletext PID in decimal (e.g. 7013), or 'auto' to\n"
+        "                take it from the PAT/PMT of the stream\n"
+        "  udp-port      UDP port to send JSON to on 127.0.0.1"
+        " (e.g. 5555), or a\n"
+        "                comma-separated list of <port>, <ipv4>:<port> and\n"
+        "                [<ipv6>]:<port> destinations, unicast or multicast\n"
+        "\n"
+        "Repeat the four arguments to ingest up to %d channels"
+        " in one process.\n"
+        "\n"
+        "Options:\n"
+        "  -u, --io-uring  Receive with io_uring multishot recv into\n"
+        "                  provided buffers (Linux >= 6.0); falls back\n"
+        "                  to recv() when unavailable\n"
+        "  -s, --stats=N   Log per-stream counters every N seconds\n"
+        "  -n, --native    Decode teletext with the built-in EN 300 706\n"
+        "                  decoder instead of libzvbi\n"
+        "  -j, --mag-workers=N\n"
+        "                  Assemble pages on N threads (1..8), split by\n"
+        "                  magazine; implies --native\n"
+        "  -d, --dedupe=N  Do not resend a page whose text is unchanged,\n"
+        "                  except every N seconds (0 = never)\n"
+        "  -D, --delta=N   Send only the rows that changed, with a full\n"
+        "                  snapshot of each page at least every N seconds\n"
+        "  -q, --query=PORT\n"
+        "                  Keep the latest copy of every page and answer\n"
+        "                  requests like \"101\" or \"101/2\" on UDP\n"
+        "                  127.0.0.1:PORT\n"
+        "  -b, --batch=N[,MS]\n"
+        "                  Send up to N (1..64) datagrams per sendmmsg(),\n"
+        "                  holding the first at most MS ms (default 2;\n"
+        "                  0 = until the output queue runs empty)\n"
+        "  -T, --ttl=N     TTL / hop limit for multicast destinations\n"
+        "  -I, --mcast-if=IFACE\n"
+        "                  Send multicast out of this interface\n"
+        "  -w, --http=[ADDR:]PORT\n"
+        "                  Push pages to WebSocket clients on /ws and to\n"
+        "                  Server-Sent Events clients on /events, e.g.\n"
+        "                  http://ADDR:PORT/events?pages=100,101-199\n"
+        "                  (ADDR defaults to 127.0.0.1)\n"
+        "  -r, --render    Also serve stored pages as PNG images on\n"
+        "                  /page/NNN.png[?sub=N&port=P] (needs --http)\n"
+        "  -f, --format=json|binary\n"
+        "                  Send pages as JSON (default) or as binary\n"
+        "                  datagrams laid out as in ttxd_wire.h\n"
+        "  -a, --attributes\n"
+        "                  Add colour, flash, conceal, size and box\n"
+        "                  attributes to each page as spans per row\n"
+        "  -g, --sextants  Send mosaic graphics as Unicode 13 sextants\n"
+        "                  (U+1FB00..) instead of spaces\n"
+        "  -m, --shm=NAME[,SLOTS]\n"
+        "                  Also write pages to a ring of SLOTS (default\n"
+        "                  1024) in /dev/shm/NAME for local readers;\n"
+        "                  see ttxd_shm.h\n",
+        prog, HDHOMERUN_PORT, MAX_STREAMS);
+}
 
-    /* Parse host[:port] from argv[1] */
-    char host[64];
-    int  stream_port = HDHOMERUN_PORT;
+/* ------------------------------------------------------------------ */
+int main(int argc, char *argv[])
+{
+    static const struct option long_opts[] = {
+        { "io-uring", no_argument,       NULL, 'u' },
+        { "stats",    required_argument, NULL, 's' },
+        { "native",   no_argument,       NULL, 'n' },
+        { "mag-workers", required_argument, NULL, 'j' },
+        { "dedupe",   required_argument, NULL, 'd' },
+        { "delta",    required_argument, NULL, 'D' },
+        { "query",    required_argument, NULL, 'q' },
+        { "http",     required_argument, NULL, 'w' },
+        { "batch",    required_argument, NULL, 'b' },
+        { "ttl",      required_argument, NULL, 'T' },
+        { "mcast-if", required_argument, NULL, 'I' },
+        { "shm",      required_argument, NULL, 'm' },
+        { "format",   required_argument, NULL, 'f' },
+        { "attributes", no_argument,     NULL, 'a' },
+        { "sextants", no_argument,       NULL, 'g' },
+        { "render",   no_argument,       NULL, 'r' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL,       0,                 NULL,  0  }
+    };
 
-    char *colon = strchr(argv[1], ':');
-    if (colon) {
-        size_t hlen = (size_t)(colon - argv[1]);
-        if (hlen == 0 || hlen >= sizeof(host)) {
-            fprintf(stderr, "ttxd: invalid host argument\n");
+    int         query_port = 0;
+    const char *http_spec  = NULL;
+    const char *shm_spec   = NULL;
+    int         opt;
+    while ((opt = getopt_long(argc, argv, "us:nj:d:D:q:w:b:T:I:m:f:agrh", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'u': g_use_uring = 1; break;
+        case 's': g_stats_interval = atoi(optarg); break;
+        case 'n': g_native = 1; break;
+        case 'j':
+            g_mag.n = atoi(optarg);
+            if (g_mag.n < 1 || g_mag.n > 8) {
+                fprintf(stderr, "ttxd: --mag-workers must be 1..8\n");
+                return 1;
+            }
+            g_native = 1;
+            break;
+        case 'd':
+            g_dedupe    = 1;
+            g_heartbeat = atoi(optarg);
+            if (g_heartbeat < 0) {
+                fprintf(stderr, "ttxd: --dedupe heartbeat must be >= 0\n");
+                return 1;
+            }
+            break;
+        case 'q':
+            query_port = atoi(optarg);
+            if (query_port <= 0 || query_port > 65535) {
+                fprintf(stderr, "ttxd: invalid query port %d\n", query_port);
+                return 1;
+            }
+            break;
+        case 'w': http_spec = optarg; break;
+        case 'm': shm_spec  = optarg; break;
+        case 'a': g_attrs   = 1; break;
+        case 'g': g_sextants = 1; break;
+        case 'r':
+#ifdef HAVE_PNG
+            g_render = 1;
+            break;
+#else
+            fprintf(stderr, "ttxd: built with -DTTXD_NO_PNG, no --render\n");
             return 1;
+#endif
+        case 'f':
+            if (strcmp(optarg, "binary") == 0)    g_binary = 1;
+            else if (strcmp(optarg, "json") != 0) {
+                fprintf(stderr, "ttxd: --format must be json or binary\n");
+                return 1;
+            }
+            break;
+        case 'T':
+            g_mcast_ttl = atoi(optarg);
+            if (g_mcast_ttl < 0 || g_mcast_ttl > 255) {
+                fprintf(stderr, "ttxd: --ttl must be 0..255\n");
+                return 1;
+            }
+            break;
+        case 'I':
+            g_mcast_if = if_nametoindex(optarg);
+            if (!g_mcast_if) {
+                fprintf(stderr, "ttxd: unknown interface %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b': {
+            char *comma = strchr(optarg, ',');
+            g_batch.max       = atoi(optarg);
+            g_batch.window_ms = comma ? atoi(comma + 1) : 2;
+            if (g_batch.max < 1 || g_batch.max > UDP_BATCH_MAX ||
+                g_batch.window_ms < 0) {
+                fprintf(stderr, "ttxd: --batch must be 1..%d[,ms]\n",
+                        UDP_BATCH_MAX);
+                return 1;
+            }
+            if (g_batch.max == 1)
+                g_batch.max = 0;        /* one per call: plain sendto */
+            break;
+        }
+        case 'D':
+            g_delta = atoi(optarg);
+            if (g_delta < 1) {
+                fprintf(stderr, "ttxd: --delta interval must be >= 1\n");
+                return 1;
+            }
+            break;
+        default:  usage(argv[0]); return 1;
         }
-        memcpy(host, argv[1], hlen);
-        host[hlen]  = '\0';
-        stream_port = atoi(colon + 1);
-    } else {
-        strncpy(host, argv[1], sizeof(host) - 1);
-        host[sizeof(host) - 1] = '\0';
     }
 
-    int channel  = atoi(argv[2]);
-    g_pid        = atoi(argv[3]);
-    int udp_port = atoi(argv[4]);
-
-    if (g_pid <= 0 || g_pid > 8191) {
-        fprintf(stderr, "ttxd: invalid PID %d\n", g_pid);
+    int nargs = argc - optind;
+    if (nargs < 4 || nargs % 4 != 0) {
+        usage(argv[0]);
         return 1;
     }
-    if (udp_port <= 0 || udp_port > 65535) {
-        fprintf(stderr, "ttxd: invalid UDP port %d\n", udp_port);
+    if (g_render && !http_spec) {
+        fprintf(stderr, "ttxd: --render needs --http\n");
         return 1;
     }
-    if (stream_port <= 0 || stream_port > 65535) {
-        fprintf(stderr, "ttxd: invalid stream port %d\n", stream_port);
+
+    g_nstreams = nargs / 4;
+    if (g_nstreams > MAX_STREAMS) {
+        fprintf(stderr, "ttxd: too many streams (max %d)\n", MAX_STREAMS);
         return 1;
     }
 
+    for (int i = 0; i < g_nstreams; i++) {
+        if (!stream_parse(&g_streams[i], argv + optind + i * 4)) return 1;
+    }
+
+    ts_filter_select();
+    crc32_init();
+    sextant_init();
+    ham_init();
+
     signal(SIGINT,  signal_handler);
     signal(SIGTERM, signal_handler);
     signal(SIGPIPE, SIG_IGN);
 
-    /* UDP socket ---------------------------------------------------- */
+    /* UDP sockets: IPv4 always, IPv6 if a stream sends there ------ */
+    int want6 = 0;
+    for (int i = 0; i < g_nstreams; i++)
+        for (int k = 0; k < g_streams[i].ndest; k++)
+            want6 |= g_streams[i].dest[k].addr.ss_family == AF_INET6;
+
     g_udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (g_udp_fd < 0) { perror("ttxd: udp socket"); return 1; }
+    if (want6) {
+        g_udp6_fd = socket(AF_INET6, SOCK_DGRAM, 0);
+        if (g_udp6_fd < 0) { perror("ttxd: udp6 socket"); return 1; }
+    }
 
-    memset(&g_dest, 0, sizeof(g_dest));
-    g_dest.sin_family      = AF_INET;
-    g_dest.sin_port        = htons((uint16_t)udp_port);
-    g_dest.sin_addr.s_addr = inet_addr("127.0.0.1");
+    /* Multicast TTL and interface; unicast is not affected */
+    if (g_mcast_ttl >= 0 &&
+        (setsockopt(g_udp_fd, IPPROTO_IP, IP_MULTICAST_TTL,
+                    &g_mcast_ttl, sizeof(g_mcast_ttl)) < 0 ||
+         (g_udp6_fd >= 0 &&
+          setsockopt(g_udp6_fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+                     &g_mcast_ttl, sizeof(g_mcast_ttl)) < 0))) {
+        perror("ttxd: multicast ttl");
+        return 1;
+    }
+    if (g_mcast_if) {
+        struct ip_mreqn mr;
+        int             idx = (int)g_mcast_if;
+        memset(&mr, 0, sizeof(mr));
+        mr.imr_ifindex = idx;
+        if (setsockopt(g_udp_fd, IPPROTO_IP, IP_MULTICAST_IF,
+                       &mr, sizeof(mr)) < 0 ||
+            (g_udp6_fd >= 0 &&
+             setsockopt(g_udp6_fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+                        &idx, sizeof(idx)) < 0)) {
+            perror("ttxd: multicast interface");
+            return 1;
+        }
+    }
 
-    /* libzvbi ------------------------------------------------------- */
-    if (!zvbi_init()) return 1;
+    if (query_port) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons((uint16_t)query_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 
-    fprintf(stderr,
-            "ttxd: stream=http://%s:%d/auto/v%d  PID=%d  → udp://127.0.0.1:%d\n",
-            host, stream_port, channel, g_pid, udp_port);
+        g_query_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (g_query_fd < 0) { perror("ttxd: query socket"); return 1; }
+        if (bind(g_query_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "ttxd: query port %d: %s\n", query_port,
+                    strerror(errno));
+            return 1;
+        }
+    }
+    if (http_spec && !web_listen(http_spec))
+        return 1;
+    if (shm_spec && !shm_ring_open(shm_spec))
+        return 1;
 
-    /* Main reconnect loop ------------------------------------------- */
-    static uint8_t rbuf[RECV_BUF_SIZE];
+    /* The output thread waits on the query and HTTP sockets too     */
+    g_cache_on = g_query_fd >= 0 || g_web.fd >= 0;
+    if (g_cache_on) {
+        struct epoll_event qev = { .events = EPOLLIN, .data.ptr = &g_query_ev };
+        struct epoll_event wev = { .events = EPOLLIN, .data.ptr = &g_web.ev };
 
-    while (g_running) {
-        /* Reset accumulation state on each connection attempt */
-        g_carry_len  = 0;
-        g_pes_len    = 0;
-        g_pes_target = 0;
-
-        /* Recreate demuxer so its internal state is clean */
-        if (!zvbi_init()) break;
-
-        int tcp_fd = tcp_connect(host, stream_port);
-        if (tcp_fd < 0) {
-            fprintf(stderr, "ttxd: connect failed — retrying in 5s\n");
-            sleep(5);
-            continue;
+        g_out_epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (g_out_epfd < 0 ||
+            (g_query_fd >= 0 &&
+             epoll_ctl(g_out_epfd, EPOLL_CTL_ADD, g_query_fd, &qev) < 0) ||
+            (g_web.fd >= 0 &&
+             epoll_ctl(g_out_epfd, EPOLL_CTL_ADD, g_web.fd, &wev) < 0)) {
+            perror("ttxd: output epoll");
+            return 1;
         }
+    }
 
-        if (!http_request(tcp_fd, host, stream_port, channel) ||
-            !http_skip_headers(tcp_fd)) {
-            close(tcp_fd);
-            sleep(5);
-            continue;
+    /* Event loop ---------------------------------------------------- */
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epfd < 0) { perror("ttxd: epoll_create1"); return 1; }
+
+    if (g_use_uring) {
+#ifdef HAVE_IO_URING
+        if (!uring_init(uring_event)) {
+            fprintf(stderr, "ttxd: io_uring unavailable, using recv()\n");
+            g_use_uring = 0;
         }
+#else
+        fprintf(stderr, "ttxd: built without io_uring, using recv()\n");
+        g_use_uring = 0;
+#endif
+    }
 
-        fprintf(stderr, "ttxd: connected, receiving stream\n");
+    /* Worker threads leave SIGINT/SIGTERM to this one */
+    sigset_t sigs, old;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old);
 
-        /* Stream receive loop */
-        while (g_running) {
-            ssize_t n = recv(tcp_fd, rbuf, sizeof(rbuf), 0);
-            if (n <= 0) {
-                if (n < 0 && errno == EINTR) continue;
-                break;
-            }
-            process_chunk(rbuf, (size_t)n);
-        }
+    if (g_mag.n > 0 && !mag_pool_start()) {
+        mag_pool_stop();
+        return 1;
+    }
+
+    /* The demux thread takes over decoder state from here on */
+    for (int i = 0; i < g_nstreams; i++)
+        stream_reset(&g_streams[i]);
 
-        close(tcp_fd);
+    if (!pipe_start()) return 1;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
 
-        if (g_running) {
-            fprintf(stderr, "ttxd: stream ended — retrying in 5s\n");
-            sleep(5);
+    /* Every stream starts ST_IDLE with deadline 0, so the first     */
+    /* stream_timers() call opens all connections.                     */
+    while (g_running) {
+        struct epoll_event events[MAX_STREAMS + 1];
+
+        int timeout = stream_timers();
+        int n = epoll_wait(g_epfd, events, MAX_STREAMS + 1, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("ttxd: epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct ev_handler *h = events[i].data.ptr;
+            h->fn(h, events[i].events);
         }
     }
 
     fprintf(stderr, "ttxd: shutting down\n");
 
-    if (g_dec)   vbi_decoder_delete(g_dec);
-    if (g_demux) vbi_dvb_demux_delete(g_demux);
+    /* The demux drains what was received and stops the magazine     */
+    /* workers before the decoder state below is freed                */
+    pipe_stop();
+    if (g_stats_interval > 0)
+        stats_report();
+
+    for (int i = 0; i < g_nstreams; i++) {
+        struct ttx_stream *s = &g_streams[i];
+        if (s->fd >= 0) close(s->fd);
+#ifdef HAVE_ZVBI
+        if (s->dec)     vbi_decoder_delete(s->dec);
+        if (s->demux)   vbi_dvb_demux_delete(s->demux);
+#endif
+        free(s->ttx);
+        free(s->hdr);
+        pes_reset(s);
+    }
+    while (g_spill_free) {
+        struct pes_spill *b = g_spill_free;
+        g_spill_free = b->next;
+        free(b);
+    }
+    pipe_free();
+    free(g_seen);
+    web_free();
+    cache_free();
+    shm_ring_close();
+    if (g_query_fd >= 0) close(g_query_fd);
+    if (g_out_epfd >= 0) close(g_out_epfd);
+#ifdef HAVE_IO_URING
+    if (g_uring.fd >= 0) close(g_uring.fd);
+#endif
+    close(g_epfd);
     close(g_udp_fd);
+    if (g_udp6_fd >= 0) close(g_udp6_fd);
 
     return 0;
 }
@@ -0,0 +1,34 @@
+/*
+ * ttxd_attr.h  —  Display attributes of a page cell
+ *
+ * One 16-bit word per character cell, as ttxd carries them in the
+ * --shm ring (ttxd_shm.h), in binary datagrams (ttxd_wire.h) and in
+ * the "attrs" spans of the JSON output (--attributes).
+ *
+ *   bits 0–2   foreground colour
+ *   bits 4–6   background colour
+ *   bit  8     flash
+ *   bit  9     conceal
+ *   bit 10     double height (the upper of the two rows)
+ *   bit 11     boxed (native decoder only)
+ *
+ * Colours are the eight of level 1: 0 black, 1 red, 2 green,
+ * 3 yellow, 4 blue, 5 magenta, 6 cyan, 7 white.  A cell holding a
+ * spacing attribute shows as a space in the colours in effect there.
+ * Every row starts out as TTXD_ATTR_DEFAULT, white on black.
+ */
+#ifndef TTXD_ATTR_H
+#define TTXD_ATTR_H
+
+#include <stdint.h>
+
+#define TTXD_ATTR_FG(a)     ((a) & 0x7)
+#define TTXD_ATTR_BG(a)     ((a) >> 4 & 0x7)
+#define TTXD_ATTR_COLOURS(fg, bg) ((uint16_t)((fg) | (bg) << 4))
+#define TTXD_ATTR_FLASH     0x0100
+#define TTXD_ATTR_CONCEAL   0x0200
+#define TTXD_ATTR_DOUBLE    0x0400
+#define TTXD_ATTR_BOXED     0x0800
+#define TTXD_ATTR_DEFAULT   TTXD_ATTR_COLOURS(7, 0)
+
+#endif /* TTXD_ATTR_H */
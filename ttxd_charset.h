@@ -0,0 +1,64 @@
+/*
+ * ttxd_charset.h  —  Level 1 character set of the native decoder
+ *
+ * Latin G0 with the national option subsets of EN 300 706 table 36,
+ * as selected by the page header's C12–C14 under the default
+ * character set designation.  Characters outside the 13 national
+ * positions are plain ASCII.
+ *
+ * Header only, so ttxd.c and the self-check in bench_hamming.c use
+ * the same tables.
+ */
+#ifndef TTXD_CHARSET_H
+#define TTXD_CHARSET_H
+
+/* Table 36 row for a header's control bits: hbits is byte 9 of the   */
+/* header after Hamming 8/4 decoding, C11 in bit 0 up to C14 in bit   */
+/* 3.  The table reads C12 C13 C14 as a number with C12 on top, so    */
+/* the bits swap ends: C14 alone selects German (1), C12 alone       */
+/* French (4).                                                        */
+static inline int ttxd_national(int hbits)
+{
+    return ((hbits >> 1) & 1) << 2 | ((hbits >> 2) & 1) << 1 |
+           ((hbits >> 3) & 1);
+}
+
+static const unsigned char ttxd_nat_pos[13] = {
+    0x23, 0x24, 0x40, 0x5B, 0x5C, 0x5D, 0x5E, 0x5F, 0x60, 0x7B, 0x7C, 0x7D, 0x7E
+};
+static const unsigned short ttxd_nat_chr[8][13] = {
+    /* English */
+    { 0x00A3, 0x0024, 0x0040, 0x2190, 0x00BD, 0x2192, 0x2191, 0x0023,
+      0x2015, 0x00BC, 0x2016, 0x00BE, 0x00F7 },
+    /* German */
+    { 0x0023, 0x0024, 0x00A7, 0x00C4, 0x00D6, 0x00DC, 0x005E, 0x005F,
+      0x00B0, 0x00E4, 0x00F6, 0x00FC, 0x00DF },
+    /* Swedish / Finnish / Hungarian */
+    { 0x0023, 0x00A4, 0x00C9, 0x00C4, 0x00D6, 0x00C5, 0x00DC, 0x005F,
+      0x00E9, 0x00E4, 0x00F6, 0x00E5, 0x00FC },
+    /* Italian */
+    { 0x00A3, 0x0024, 0x00E9, 0x00B0, 0x00E7, 0x2192, 0x2191, 0x0023,
+      0x00F9, 0x00E0, 0x00F2, 0x00E8, 0x00EC },
+    /* French */
+    { 0x00E9, 0x00EF, 0x00E0, 0x00EB, 0x00EA, 0x00F9, 0x00EE, 0x0023,
+      0x00E8, 0x00E2, 0x00F4, 0x00FB, 0x00E7 },
+    /* Portuguese / Spanish */
+    { 0x00E7, 0x0024, 0x00A1, 0x00E1, 0x00E9, 0x00ED, 0x00F3, 0x00FA,
+      0x00BF, 0x00FC, 0x00F1, 0x00E8, 0x00E0 },
+    /* Czech / Slovak */
+    { 0x0023, 0x016F, 0x010D, 0x0165, 0x017E, 0x00FD, 0x00ED, 0x0159,
+      0x00E9, 0x00E1, 0x011B, 0x00FA, 0x0161 },
+    /* not defined: English */
+    { 0x00A3, 0x0024, 0x0040, 0x2190, 0x00BD, 0x2192, 0x2191, 0x0023,
+      0x2015, 0x00BC, 0x2016, 0x00BE, 0x00F7 },
+};
+
+/* Unicode for 7-bit character c (0x20–0x7E) in national subset n     */
+static inline unsigned int ttxd_g0(int n, int c)
+{
+    for (int k = 0; k < 13; k++)
+        if (ttxd_nat_pos[k] == c) return ttxd_nat_chr[n][k];
+    return (unsigned int)c;
+}
+
+#endif /* TTXD_CHARSET_H */
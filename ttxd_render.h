@@ -0,0 +1,498 @@
+/*
+ * ttxd_render.h  —  Render a page to an 8-colour indexed image, and
+ *                   encode it as PNG
+ *
+ * The page grid (code points as in ttxd_shm.h, attribute words as in
+ * ttxd_attr.h) is drawn into a 480×500 framebuffer of 4-bit palette
+ * indices, one 12×20 pixel cell per character:
+ *
+ *   glyph atlas   built once by ttxd_render_init(): every character
+ *                 the renderer knows, pre-rasterized as 20 rows of
+ *                 12-bit masks.  Text comes from a built-in 5×8 font
+ *                 drawn at twice its size; accented Latin letters are
+ *                 a base letter plus a mark; block mosaics, contiguous
+ *                 and separated, are cut from the 2×3 cell pattern.
+ *   blit          one whole cell at a time: each mask row becomes six
+ *                 bytes (two pixels per byte) through a table of
+ *                 foreground/background pairs, so a cell costs 120
+ *                 byte lookups and no per-pixel branching.
+ *   PNG           the framebuffer rows are laid out as PNG scanlines
+ *                 (filter byte, then 240 bytes of pixels), so encoding
+ *                 is one compress2() call over the whole buffer plus
+ *                 the chunk headers.
+ *
+ * Level 1 presentation: colours, double height (the row below is
+ * covered), conceal (shown as spaces unless revealed).  Flashing cells
+ * are drawn in their on phase, and boxing is ignored since there is no
+ * picture to box against.  Characters outside the atlas (non-Latin
+ * scripts, for instance) are drawn as a hollow box.
+ *
+ * Header only, like ttxd_shm.h: ttxd.c includes it for --render, and
+ * a consumer can include it to draw pages it reads from the ring.
+ * The struct is about 250 KB, so allocate it rather than putting it on
+ * the stack.  Link with -lz.
+ *
+ *   struct ttxd_render *r = malloc(sizeof(*r));
+ *   ttxd_render_init(r);
+ *   ttxd_render_page(r, slot.text, slot.attr, 0);
+ *   long n = ttxd_render_png(r, Z_BEST_SPEED);
+ *   if (n > 0) fwrite(r->png, 1, (size_t)n, f);
+ */
+#ifndef TTXD_RENDER_H
+#define TTXD_RENDER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "ttxd_attr.h"
+
+#define TTXD_RENDER_ROWS    25
+#define TTXD_RENDER_COLS    40
+#define TTXD_RENDER_CW      12          /* cell size in pixels          */
+#define TTXD_RENDER_CH      20
+#define TTXD_RENDER_WIDTH   (TTXD_RENDER_COLS * TTXD_RENDER_CW)
+#define TTXD_RENDER_HEIGHT  (TTXD_RENDER_ROWS * TTXD_RENDER_CH)
+#define TTXD_RENDER_STRIDE  (1 + TTXD_RENDER_WIDTH / 2) /* filter + pixels */
+#define TTXD_RENDER_FB_SIZE (TTXD_RENDER_HEIGHT * TTXD_RENDER_STRIDE)
+
+/* compressBound() of the framebuffer, plus signature and chunks       */
+#define TTXD_RENDER_PNG_MAX (TTXD_RENDER_FB_SIZE + \
+                             (TTXD_RENDER_FB_SIZE >> 12) + \
+                             (TTXD_RENDER_FB_SIZE >> 14) + 13 + 128)
+
+/* ------------------------------------------------------------------ */
+/* Font                                                                */
+/* ------------------------------------------------------------------ */
+
+/* 5×8 glyphs for 0x20..0x7E, one byte per column, bit 0 = top row.   */
+/* Capitals use rows 0–6, small letters 2–6, descenders row 7.         */
+static const uint8_t ttxd_render_font[95][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 },
+    { 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7F, 0x14, 0x7F, 0x14 },
+    { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+    { 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 },
+    { 0x00, 0x1C, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1C, 0x00 },
+    { 0x2A, 0x1C, 0x7F, 0x1C, 0x2A }, { 0x08, 0x08, 0x3E, 0x08, 0x08 },
+    { 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 },
+    { 0x00, 0x60, 0x60, 0x00, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 },
+    { 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 },  /* 0 */
+    { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4B, 0x31 },
+    { 0x18, 0x14, 0x12, 0x7F, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 },
+    { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+    { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1E },
+    { 0x00, 0x36, 0x36, 0x00, 0x00 }, { 0x00, 0x56, 0x36, 0x00, 0x00 },  /* : */
+    { 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+    { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 },
+    { 0x32, 0x49, 0x79, 0x41, 0x3E }, { 0x7E, 0x11, 0x11, 0x11, 0x7E },  /* @ */
+    { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 },
+    { 0x7F, 0x41, 0x41, 0x22, 0x1C }, { 0x7F, 0x49, 0x49, 0x49, 0x41 },
+    { 0x7F, 0x09, 0x09, 0x09, 0x01 }, { 0x3E, 0x41, 0x49, 0x49, 0x7A },
+    { 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 },
+    { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 },
+    { 0x7F, 0x40, 0x40, 0x40, 0x40 }, { 0x7F, 0x02, 0x0C, 0x02, 0x7F },
+    { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E },
+    { 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E },  /* P */
+    { 0x7F, 0x09, 0x19, 0x29, 0x46 }, { 0x26, 0x49, 0x49, 0x49, 0x32 },
+    { 0x01, 0x01, 0x7F, 0x01, 0x01 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F },
+    { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F },
+    { 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x07, 0x08, 0x70, 0x08, 0x07 },
+    { 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x00 },  /* Z */
+    { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7F, 0x00 },
+    { 0x04, 0x02, 0x01, 0x02, 0x04 }, { 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0x00, 0x01, 0x02, 0x04, 0x00 }, { 0x20, 0x54, 0x54, 0x54, 0x78 },  /* ` */
+    { 0x7F, 0x48, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x20 },
+    { 0x38, 0x44, 0x44, 0x48, 0x7F }, { 0x38, 0x54, 0x54, 0x54, 0x18 },
+    { 0x08, 0x7E, 0x09, 0x01, 0x02 }, { 0x18, 0xA4, 0xA4, 0xA4, 0x7C },
+    { 0x7F, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7D, 0x40, 0x00 },
+    { 0x40, 0x80, 0x84, 0x7D, 0x00 }, { 0x7F, 0x10, 0x28, 0x44, 0x00 },
+    { 0x00, 0x41, 0x7F, 0x40, 0x00 }, { 0x7C, 0x04, 0x18, 0x04, 0x78 },
+    { 0x7C, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 },
+    { 0xFC, 0x24, 0x24, 0x24, 0x18 }, { 0x18, 0x24, 0x24, 0x18, 0xFC },  /* p */
+    { 0x7C, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x20 },
+    { 0x04, 0x3F, 0x44, 0x40, 0x20 }, { 0x3C, 0x40, 0x40, 0x20, 0x7C },
+    { 0x1C, 0x20, 0x40, 0x20, 0x1C }, { 0x3C, 0x40, 0x30, 0x40, 0x3C },
+    { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x1C, 0xA0, 0xA0, 0xA0, 0x7C },
+    { 0x44, 0x64, 0x54, 0x4C, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 },  /* z */
+    { 0x00, 0x00, 0x7F, 0x00, 0x00 }, { 0x00, 0x41, 0x36, 0x08, 0x00 },
+    { 0x08, 0x04, 0x08, 0x10, 0x08 },
+};
+
+/* Symbols of the national option subsets that are not in ASCII       */
+static const uint8_t ttxd_render_symbol[][5] = {
+    { 0x00, 0x00, 0x7D, 0x00, 0x00 },  /* ¡ */
+    { 0x48, 0x7E, 0x49, 0x49, 0x42 },  /* £ */
+    { 0x22, 0x1C, 0x14, 0x1C, 0x22 },  /* ¤ */
+    { 0x0A, 0x55, 0x55, 0x55, 0x28 },  /* § */
+    { 0x06, 0x09, 0x09, 0x06, 0x00 },  /* ° */
+    { 0x27, 0x10, 0x08, 0x34, 0xE2 },  /* ¼ */
+    { 0x27, 0x10, 0x08, 0xD4, 0xB2 },  /* ½ */
+    { 0x25, 0x17, 0x08, 0x34, 0xE2 },  /* ¾ */
+    { 0x30, 0x48, 0x45, 0x40, 0x20 },  /* ¿ */
+    { 0xFE, 0x01, 0x45, 0x4A, 0x30 },  /* ß */
+    { 0x08, 0x08, 0x2A, 0x08, 0x08 },  /* ÷ */
+    { 0x08, 0x08, 0x08, 0x08, 0x08 },  /* ― */
+    { 0x00, 0x7F, 0x00, 0x7F, 0x00 },  /* ‖ */
+    { 0x08, 0x1C, 0x2A, 0x08, 0x08 },  /* ← */
+    { 0x04, 0x02, 0x7F, 0x02, 0x04 },  /* ↑ */
+    { 0x08, 0x08, 0x2A, 0x1C, 0x08 },  /* → */
+    { 0x7F, 0x7F, 0x7F, 0x7F, 0x7F },  /* ■ */
+};
+
+/* Marks over (or, for cedilla and ogonek, under) a base letter: rows  */
+/* 0 and 1 above a small letter, and the single row left above a       */
+/* capital, which moves down one.  Five bits per row, bit 4 = left.    */
+static const char    ttxd_render_marks[] = "'`^:~vo\".u-,;";
+static const uint8_t ttxd_render_mark[][3] = {
+    { 0x02, 0x04, 0x06 },   /* '  acute        */
+    { 0x08, 0x04, 0x0C },   /* `  grave        */
+    { 0x04, 0x0A, 0x0E },   /* ^  circumflex   */
+    { 0x0A, 0x00, 0x0A },   /* :  diaeresis    */
+    { 0x0D, 0x12, 0x0D },   /* ~  tilde        */
+    { 0x0A, 0x04, 0x0E },   /* v  caron        */
+    { 0x0E, 0x0A, 0x04 },   /* o  ring         */
+    { 0x05, 0x0A, 0x0A },   /* "  double acute */
+    { 0x04, 0x00, 0x04 },   /* .  dot          */
+    { 0x11, 0x0E, 0x0E },   /* u  breve        */
+    { 0x0E, 0x00, 0x0E },   /* -  macron       */
+    { 0x06, 0x00, 0x00 },   /* ,  cedilla      */
+    { 0x03, 0x00, 0x00 },   /* ;  ogonek       */
+};
+
+/* Characters past ASCII, sorted by code point: a base letter and a    */
+/* mark from ttxd_render_marks, or base 0 and a ttxd_render_symbol     */
+/* index.  Latin-1 and Latin Extended-A, which covers the G0 national  */
+/* subsets and the G2 letters libzvbi composes from packet 26.         */
+struct ttxd_render_extra {
+    uint16_t            cp;
+    char                base;
+    char                mark;
+};
+
+static const struct ttxd_render_extra ttxd_render_extras[] = {
+    { 0x00A1,  0,   0  }, { 0x00A3,  0,   1  }, { 0x00A4,  0,   2  },
+    { 0x00A7,  0,   3  }, { 0x00B0,  0,   4  }, { 0x00BC,  0,   5  },
+    { 0x00BD,  0,   6  }, { 0x00BE,  0,   7  }, { 0x00BF,  0,   8  },
+    { 0x00C0, 'A', '`'  }, { 0x00C1, 'A', '\'' }, { 0x00C2, 'A', '^'  },
+    { 0x00C3, 'A', '~'  }, { 0x00C4, 'A', ':'  }, { 0x00C5, 'A', 'o'  },
+    { 0x00C7, 'C', ','  }, { 0x00C8, 'E', '`'  }, { 0x00C9, 'E', '\'' },
+    { 0x00CA, 'E', '^'  }, { 0x00CB, 'E', ':'  }, { 0x00CC, 'I', '`'  },
+    { 0x00CD, 'I', '\'' }, { 0x00CE, 'I', '^'  }, { 0x00CF, 'I', ':'  },
+    { 0x00D1, 'N', '~'  }, { 0x00D2, 'O', '`'  }, { 0x00D3, 'O', '\'' },
+    { 0x00D4, 'O', '^'  }, { 0x00D5, 'O', '~'  }, { 0x00D6, 'O', ':'  },
+    { 0x00D9, 'U', '`'  }, { 0x00DA, 'U', '\'' }, { 0x00DB, 'U', '^'  },
+    { 0x00DC, 'U', ':'  }, { 0x00DD, 'Y', '\'' }, { 0x00DF,  0,   9  },
+    { 0x00E0, 'a', '`'  }, { 0x00E1, 'a', '\'' }, { 0x00E2, 'a', '^'  },
+    { 0x00E3, 'a', '~'  }, { 0x00E4, 'a', ':'  }, { 0x00E5, 'a', 'o'  },
+    { 0x00E7, 'c', ','  }, { 0x00E8, 'e', '`'  }, { 0x00E9, 'e', '\'' },
+    { 0x00EA, 'e', '^'  }, { 0x00EB, 'e', ':'  }, { 0x00EC, 'i', '`'  },
+    { 0x00ED, 'i', '\'' }, { 0x00EE, 'i', '^'  }, { 0x00EF, 'i', ':'  },
+    { 0x00F1, 'n', '~'  }, { 0x00F2, 'o', '`'  }, { 0x00F3, 'o', '\'' },
+    { 0x00F4, 'o', '^'  }, { 0x00F5, 'o', '~'  }, { 0x00F6, 'o', ':'  },
+    { 0x00F7,  0,  10  }, { 0x00F9, 'u', '`'  }, { 0x00FA, 'u', '\'' },
+    { 0x00FB, 'u', '^'  }, { 0x00FC, 'u', ':'  }, { 0x00FD, 'y', '\'' },
+    { 0x00FF, 'y', ':'  }, { 0x0100, 'A', '-'  }, { 0x0101, 'a', '-'  },
+    { 0x0102, 'A', 'u'  }, { 0x0103, 'a', 'u'  }, { 0x0104, 'A', ';'  },
+    { 0x0105, 'a', ';'  }, { 0x0106, 'C', '\'' }, { 0x0107, 'c', '\'' },
+    { 0x0108, 'C', '^'  }, { 0x0109, 'c', '^'  }, { 0x010A, 'C', '.'  },
+    { 0x010B, 'c', '.'  }, { 0x010C, 'C', 'v'  }, { 0x010D, 'c', 'v'  },
+    { 0x010E, 'D', 'v'  }, { 0x010F, 'd', 'v'  }, { 0x0112, 'E', '-'  },
+    { 0x0113, 'e', '-'  }, { 0x0114, 'E', 'u'  }, { 0x0115, 'e', 'u'  },
+    { 0x0116, 'E', '.'  }, { 0x0117, 'e', '.'  }, { 0x0118, 'E', ';'  },
+    { 0x0119, 'e', ';'  }, { 0x011A, 'E', 'v'  }, { 0x011B, 'e', 'v'  },
+    { 0x011C, 'G', '^'  }, { 0x011D, 'g', '^'  }, { 0x011E, 'G', 'u'  },
+    { 0x011F, 'g', 'u'  }, { 0x0120, 'G', '.'  }, { 0x0121, 'g', '.'  },
+    { 0x0122, 'G', ','  }, { 0x0123, 'g', ','  }, { 0x0124, 'H', '^'  },
+    { 0x0125, 'h', '^'  }, { 0x0128, 'I', '~'  }, { 0x0129, 'i', '~'  },
+    { 0x012A, 'I', '-'  }, { 0x012B, 'i', '-'  }, { 0x012C, 'I', 'u'  },
+    { 0x012D, 'i', 'u'  }, { 0x012E, 'I', ';'  }, { 0x012F, 'i', ';'  },
+    { 0x0130, 'I', '.'  }, { 0x0134, 'J', '^'  }, { 0x0135, 'j', '^'  },
+    { 0x0136, 'K', ','  }, { 0x0137, 'k', ','  }, { 0x0139, 'L', '\'' },
+    { 0x013A, 'l', '\'' }, { 0x013B, 'L', ','  }, { 0x013C, 'l', ','  },
+    { 0x013D, 'L', 'v'  }, { 0x013E, 'l', 'v'  }, { 0x0143, 'N', '\'' },
+    { 0x0144, 'n', '\'' }, { 0x0145, 'N', ','  }, { 0x0146, 'n', ','  },
+    { 0x0147, 'N', 'v'  }, { 0x0148, 'n', 'v'  }, { 0x014C, 'O', '-'  },
+    { 0x014D, 'o', '-'  }, { 0x014E, 'O', 'u'  }, { 0x014F, 'o', 'u'  },
+    { 0x0150, 'O', '"'  }, { 0x0151, 'o', '"'  }, { 0x0154, 'R', '\'' },
+    { 0x0155, 'r', '\'' }, { 0x0156, 'R', ','  }, { 0x0157, 'r', ','  },
+    { 0x0158, 'R', 'v'  }, { 0x0159, 'r', 'v'  }, { 0x015A, 'S', '\'' },
+    { 0x015B, 's', '\'' }, { 0x015C, 'S', '^'  }, { 0x015D, 's', '^'  },
+    { 0x015E, 'S', ','  }, { 0x015F, 's', ','  }, { 0x0160, 'S', 'v'  },
+    { 0x0161, 's', 'v'  }, { 0x0162, 'T', ','  }, { 0x0163, 't', ','  },
+    { 0x0164, 'T', 'v'  }, { 0x0165, 't', 'v'  }, { 0x0168, 'U', '~'  },
+    { 0x0169, 'u', '~'  }, { 0x016A, 'U', '-'  }, { 0x016B, 'u', '-'  },
+    { 0x016C, 'U', 'u'  }, { 0x016D, 'u', 'u'  }, { 0x016E, 'U', 'o'  },
+    { 0x016F, 'u', 'o'  }, { 0x0170, 'U', '"'  }, { 0x0171, 'u', '"'  },
+    { 0x0172, 'U', ';'  }, { 0x0173, 'u', ';'  }, { 0x0174, 'W', '^'  },
+    { 0x0175, 'w', '^'  }, { 0x0176, 'Y', '^'  }, { 0x0177, 'y', '^'  },
+    { 0x0178, 'Y', ':'  }, { 0x0179, 'Z', '\'' }, { 0x017A, 'z', '\'' },
+    { 0x017B, 'Z', '.'  }, { 0x017C, 'z', '.'  }, { 0x017D, 'Z', 'v'  },
+    { 0x017E, 'z', 'v'  }, { 0x2015,  0,  11  }, { 0x2016,  0,  12  },
+    { 0x2190,  0,  13  }, { 0x2191,  0,  14  }, { 0x2192,  0,  15  },
+    { 0x25A0,  0,  16  }
+};
+
+#define TTXD_RENDER_NEXTRA  (int)(sizeof(ttxd_render_extras) / \
+                                  sizeof(ttxd_render_extras[0]))
+
+/* Atlas layout: ASCII, the extras in table order, 64 contiguous and   */
+/* 64 separated mosaics, and the box for anything else                 */
+#define TTXD_RENDER_MOSAIC  (95 + TTXD_RENDER_NEXTRA)
+#define TTXD_RENDER_MISSING (TTXD_RENDER_MOSAIC + 128)
+#define TTXD_RENDER_GLYPHS  (TTXD_RENDER_MISSING + 1)
+
+/* ------------------------------------------------------------------ */
+/* Renderer                                                            */
+/* ------------------------------------------------------------------ */
+struct ttxd_render {
+    uint16_t            glyph[TTXD_RENDER_GLYPHS][TTXD_RENDER_CH];
+                                        /* bit 11 = leftmost pixel      */
+    uint8_t             pair[8][8][4];  /* fg, bg, 2 mask bits → byte   */
+    uint8_t             fb[TTXD_RENDER_HEIGHT][TTXD_RENDER_STRIDE];
+    uint8_t             png[TTXD_RENDER_PNG_MAX];
+};
+
+/* Rasterize a 5×8 font glyph at twice its size, one pixel in from the */
+/* left and two down                                                   */
+static inline void ttxd_render_raster(uint16_t *mask, const uint8_t col[5])
+{
+    memset(mask, 0, TTXD_RENDER_CH * sizeof(*mask));
+    for (int y = 0; y < 8; y++) {
+        unsigned m = 0;
+        for (int x = 0; x < 5; x++)
+            if (col[x] >> y & 1) m |= 3u << (9 - 2 * x);
+        mask[2 + 2 * y] = mask[3 + 2 * y] = (uint16_t)m;
+    }
+}
+
+/* A base letter with a mark added                                     */
+static inline void ttxd_render_compose(uint8_t col[5], char base, char mark)
+{
+    const uint8_t *b = ttxd_render_font[base - 0x20];
+    const uint8_t *m = ttxd_render_mark[strchr(ttxd_render_marks, mark) -
+                                        ttxd_render_marks];
+
+    for (int x = 0; x < 5; x++) {
+        unsigned r0 = m[0] >> (4 - x) & 1, r1 = m[1] >> (4 - x) & 1;
+        unsigned up = m[2] >> (4 - x) & 1;
+
+        if (mark == ',' || mark == ';')
+            col[x] = (uint8_t)(b[x] | r0 << 7);
+        else if (base >= 'A' && base <= 'Z')
+            col[x] = (uint8_t)(b[x] << 1 | up);
+        else if (base == 'i' || base == 'j')    /* dotless first       */
+            col[x] = (uint8_t)((b[x] & ~3u) | r0 | r1 << 1);
+        else
+            col[x] = (uint8_t)(b[x] | r0 | r1 << 1);
+    }
+}
+
+/* A mosaic cell: 2×3 blocks of 6×7, 6×6 and 6×7 pixels, bit 0 top    */
+/* left, bit 5 bottom right.  Separated blocks lose two pixels on the */
+/* left and at the bottom.                                             */
+static inline void ttxd_render_mosaic(uint16_t *mask, int p, int separated)
+{
+    static const int top[4] = { 0, 7, 13, 20 };
+
+    for (int b = 0; b < 3; b++)
+        for (int y = top[b]; y < top[b + 1]; y++) {
+            unsigned m = 0;
+            if (separated && y >= top[b + 1] - 2) {
+                mask[y] = 0;
+                continue;
+            }
+            if (p >> (2 * b) & 1)     m |= separated ? 0x3C0u : 0xFC0u;
+            if (p >> (2 * b + 1) & 1) m |= separated ? 0x00Fu : 0x03Fu;
+            mask[y] = (uint16_t)m;
+        }
+}
+
+/* Build the glyph atlas and the blit table.  Once per struct.        */
+static inline void ttxd_render_init(struct ttxd_render *r)
+{
+    static const uint8_t box[5] = { 0x7F, 0x41, 0x41, 0x41, 0x7F };
+    uint8_t              col[5];
+
+    for (int i = 0; i < 95; i++)
+        ttxd_render_raster(r->glyph[i], ttxd_render_font[i]);
+    for (int i = 0; i < TTXD_RENDER_NEXTRA; i++) {
+        const struct ttxd_render_extra *e = &ttxd_render_extras[i];
+        if (e->base) {
+            ttxd_render_compose(col, e->base, e->mark);
+            ttxd_render_raster(r->glyph[95 + i], col);
+        } else {
+            ttxd_render_raster(r->glyph[95 + i],
+                               ttxd_render_symbol[(int)e->mark]);
+        }
+    }
+    for (int p = 0; p < 64; p++) {
+        ttxd_render_mosaic(r->glyph[TTXD_RENDER_MOSAIC + p], p, 0);
+        ttxd_render_mosaic(r->glyph[TTXD_RENDER_MOSAIC + 64 + p], p, 1);
+    }
+    ttxd_render_raster(r->glyph[TTXD_RENDER_MISSING], box);
+
+    for (int fg = 0; fg < 8; fg++)
+        for (int bg = 0; bg < 8; bg++)
+            for (int m = 0; m < 4; m++)
+                r->pair[fg][bg][m] = (uint8_t)((m & 2 ? fg : bg) << 4 |
+                                               (m & 1 ? fg : bg));
+    for (int y = 0; y < TTXD_RENDER_HEIGHT; y++)
+        r->fb[y][0] = 0;                /* PNG filter type: none       */
+}
+
+/* Atlas index of a code point                                         */
+static inline int ttxd_render_glyph(uint32_t cp)
+{
+    if (cp >= 0x20 && cp < 0x7F)
+        return (int)cp - 0x20;
+
+    /* U+EE20.. contiguous, U+EF20.. separated, as in ttxd_shm.h      */
+    if ((cp & ~0x1FFu) == 0xEE00 && (cp & 0xA0) == 0x20) {
+        unsigned c = cp & 0x7F;
+        return TTXD_RENDER_MOSAIC + (int)(cp >> 8 & 1) * 64 +
+               (int)((c & 0x1F) | (c & 0x40) >> 1);
+    }
+
+    int lo = 0, hi = TTXD_RENDER_NEXTRA;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ttxd_render_extras[mid].cp < cp) lo = mid + 1;
+        else                                 hi = mid;
+    }
+    if (lo < TTXD_RENDER_NEXTRA && ttxd_render_extras[lo].cp == cp)
+        return 95 + lo;
+    return TTXD_RENDER_MISSING;
+}
+
+/* Draw glyph g into the cell at row, col.  half < 0 draws it as it    */
+/* is; 0 and 1 draw the upper and lower half at double height.         */
+static inline void ttxd_render_blit(struct ttxd_render *r, int row, int col,
+                                    int g, unsigned fg, unsigned bg, int half)
+{
+    const uint8_t  *lut  = r->pair[fg][bg];
+    const uint16_t *mask = r->glyph[g];
+
+    for (int y = 0; y < TTXD_RENDER_CH; y++) {
+        unsigned m = mask[half < 0 ? y : (half * TTXD_RENDER_CH + y) / 2];
+        uint8_t *p = &r->fb[row * TTXD_RENDER_CH + y]
+                           [1 + col * TTXD_RENDER_CW / 2];
+
+        p[0] = lut[m >> 10 & 3];
+        p[1] = lut[m >> 8 & 3];
+        p[2] = lut[m >> 6 & 3];
+        p[3] = lut[m >> 4 & 3];
+        p[4] = lut[m >> 2 & 3];
+        p[5] = lut[m & 3];
+    }
+}
+
+/* Draw a whole page.  Concealed text is drawn only if reveal is set.  */
+static inline void ttxd_render_page(struct ttxd_render *r,
+                                    const uint32_t text[][TTXD_RENDER_COLS],
+                                    const uint16_t attr[][TTXD_RENDER_COLS],
+                                    int reveal)
+{
+    for (int row = 0; row < TTXD_RENDER_ROWS; row++) {
+        int dbl = 0;
+
+        /* A double height row covers the one below it, whose own     */
+        /* text is not shown                                           */
+        if (row < TTXD_RENDER_ROWS - 1)
+            for (int col = 0; col < TTXD_RENDER_COLS; col++)
+                if (attr[row][col] & TTXD_ATTR_DOUBLE) { dbl = 1; break; }
+
+        for (int col = 0; col < TTXD_RENDER_COLS; col++) {
+            unsigned a  = attr[row][col];
+            unsigned fg = TTXD_ATTR_FG(a), bg = TTXD_ATTR_BG(a);
+            int      g  = (a & TTXD_ATTR_CONCEAL) && !reveal ? 0 :
+                          ttxd_render_glyph(text[row][col]);
+
+            if (dbl && (a & TTXD_ATTR_DOUBLE)) {
+                ttxd_render_blit(r, row, col, g, fg, bg, 0);
+                ttxd_render_blit(r, row + 1, col, g, fg, bg, 1);
+            } else {
+                ttxd_render_blit(r, row, col, g, fg, bg, -1);
+                if (dbl)
+                    ttxd_render_blit(r, row + 1, col, 0, fg, bg, -1);
+            }
+        }
+        row += dbl;
+    }
+}
+
+/* FNV-1a over code points and attribute words: equal pages hash       */
+/* equal, so a render can be kept for as long as the hash holds        */
+static inline uint64_t ttxd_render_hash(const uint32_t text[][TTXD_RENDER_COLS],
+                                        const uint16_t attr[][TTXD_RENDER_COLS])
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (int row = 0; row < TTXD_RENDER_ROWS; row++)
+        for (int col = 0; col < TTXD_RENDER_COLS; col++)
+            h = (h ^ (text[row][col] | (uint64_t)attr[row][col] << 32)) *
+                1099511628211ULL;
+    return h;
+}
+
+/* ------------------------------------------------------------------ */
+/* PNG                                                                 */
+/* ------------------------------------------------------------------ */
+static inline void ttxd_render_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/* Close a chunk whose len data bytes follow its 8-byte head at p:    */
+/* fill in the length and append the CRC.  Returns the end.            */
+static inline uint8_t *ttxd_render_chunk(uint8_t *p, const char *type,
+                                         uint32_t len)
+{
+    ttxd_render_be32(p, len);
+    memcpy(p + 4, type, 4);
+    ttxd_render_be32(p + 8 + len,
+                     (uint32_t)crc32(0, p + 4, (uInt)len + 4));
+    return p + 12 + len;
+}
+
+/* Encode the framebuffer into r->png at a zlib level (Z_BEST_SPEED   */
+/* suits pages: large flat areas compress well at any level).          */
+/* Returns the PNG size, or -1.                                        */
+static inline long ttxd_render_png(struct ttxd_render *r, int level)
+{
+    static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G',
+                                    '\r', '\n', 0x1A, '\n' };
+    static const uint8_t plte[24] = {   /* the level 1 colours          */
+        0x00, 0x00, 0x00,  0xFF, 0x00, 0x00,  0x00, 0xFF, 0x00,
+        0xFF, 0xFF, 0x00,  0x00, 0x00, 0xFF,  0xFF, 0x00, 0xFF,
+        0x00, 0xFF, 0xFF,  0xFF, 0xFF, 0xFF
+    };
+    uint8_t *p = r->png;
+    uLongf   zlen;
+
+    memcpy(p, sig, 8);
+    p += 8;
+
+    ttxd_render_be32(p + 8, TTXD_RENDER_WIDTH);
+    ttxd_render_be32(p + 12, TTXD_RENDER_HEIGHT);
+    p[16] = 4;                          /* bits per pixel              */
+    p[17] = 3;                          /* indexed colour              */
+    p[18] = p[19] = p[20] = 0;          /* deflate, filter 0, no interlace */
+    p = ttxd_render_chunk(p, "IHDR", 13);
+
+    memcpy(p + 8, plte, sizeof(plte));
+    p = ttxd_render_chunk(p, "PLTE", sizeof(plte));
+
+    zlen = (uLongf)(r->png + sizeof(r->png) - 16 - (p + 8));
+    if (compress2(p + 8, &zlen, &r->fb[0][0], TTXD_RENDER_FB_SIZE,
+                  level) != Z_OK)
+        return -1;
+    p = ttxd_render_chunk(p, "IDAT", (uint32_t)zlen);
+
+    p = ttxd_render_chunk(p, "IEND", 0);
+    return (long)(p - r->png);
+}
+
+#endif /* TTXD_RENDER_H */
@@ -0,0 +1,214 @@
+/*
+ * ttxd_shm.h  —  Layout of the shared-memory page ring (--shm), and a
+ *                reader for it
+ *
+ * ttxd writes every decoded page into a ring of fixed-size slots in a
+ * POSIX shared memory object (/dev/shm/NAME).  A consumer on the same
+ * host maps the object read-only and copies pages out of it directly:
+ * no socket, no JSON, and no system call once the mapping exists.
+ *
+ *   header   magic, geometry, and the serial number of the next page
+ *   index    per stream and page number, the serial of its newest copy
+ *   slots    nslots × struct ttxd_shm_slot; page n sits in slot
+ *            n % nslots until nslots newer pages have pushed it out
+ *
+ * Each slot is a seqlock: the writer makes seq odd, fills the slot and
+ * makes it even again.  A reader copies the slot and keeps the copy if
+ * seq was even and unchanged across it.  Readers never write to the
+ * mapping, so any number of them can follow the ring at once.
+ *
+ * Header only, like hamming.h: ttxd.c includes it for the layout, and
+ * a consumer includes it for the reader functions.  Typical use:
+ *
+ *   struct ttxd_shm      m;
+ *   struct ttxd_shm_slot pg;
+ *   uint64_t             next;
+ *
+ *   if (ttxd_shm_open(&m, "ttxd") < 0) { perror("ttxd_shm_open"); ... }
+ *   next = ttxd_shm_head(&m);
+ *   for (;;) {
+ *       while (next == ttxd_shm_head(&m)) usleep(10000);
+ *       if (ttxd_shm_read(&m, next, &pg) > 0) use(&pg);
+ *       else next = ttxd_shm_head(&m) - 1;     (overrun: skip ahead)
+ *       next++;
+ *   }
+ */
+#ifndef TTXD_SHM_H
+#define TTXD_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ttxd_attr.h"
+
+#define TTXD_SHM_MAGIC      "TTXS"
+#define TTXD_SHM_VERSION    1
+#define TTXD_SHM_ROWS       25
+#define TTXD_SHM_COLS       40
+#define TTXD_SHM_STREAMS    64          /* ports[] entries in the header */
+#define TTXD_SHM_PAGES      800         /* index entries per stream     */
+
+/* Page header, at offset 0.  Offsets are from the start of the        */
+/* mapping; the writer fills in magic last.                            */
+struct ttxd_shm_header {
+    char                magic[4];       /* TTXD_SHM_MAGIC, no NUL       */
+    uint32_t            version;        /* TTXD_SHM_VERSION             */
+    uint32_t            size;           /* bytes in the whole object    */
+    uint32_t            nslots;         /* power of 2                   */
+    uint32_t            slot_size;      /* sizeof(struct ttxd_shm_slot) */
+    uint32_t            slots;          /* offset of slot 0             */
+    uint32_t            index;          /* offset of the page index     */
+    uint32_t            nstreams;       /* streams on the command line  */
+    uint32_t            rows, cols;     /* TTXD_SHM_ROWS, _COLS         */
+    uint32_t            closed;         /* non-zero once ttxd has exited */
+    uint32_t            pid;            /* of the writer                */
+    uint64_t            head;           /* pages written = next serial  */
+    uint16_t            port[TTXD_SHM_STREAMS]; /* first UDP port of    */
+                                        /* each stream                  */
+};
+
+/* One page.  text[] holds Unicode code points; block mosaics are in   */
+/* private use, U+EE20..EE7F contiguous and U+EF20..EF7F separated,    */
+/* low six bits of the character giving the cells (as in libzvbi).     */
+struct ttxd_shm_slot {
+    uint32_t            seq;            /* odd while being written      */
+    uint16_t            stream;         /* index on the command line    */
+    uint16_t            port;           /* its first UDP port           */
+    int32_t             pgno;           /* 100..899                     */
+    int32_t             subno;          /* 0 = no subpages              */
+    uint64_t            serial;         /* head when it was written     */
+    int64_t             time_ms;        /* wall clock, ms since 1970    */
+    uint32_t            text[TTXD_SHM_ROWS][TTXD_SHM_COLS];
+    uint16_t            attr[TTXD_SHM_ROWS][TTXD_SHM_COLS]; /* ttxd_attr.h */
+} __attribute__((aligned(64)));
+
+/* ------------------------------------------------------------------ */
+/* Reader                                                              */
+/* ------------------------------------------------------------------ */
+struct ttxd_shm {
+    const struct ttxd_shm_header *hdr;
+    size_t              size;
+};
+
+/* Map the ring ttxd was started with (--shm=NAME).  Returns 0, or -1  */
+/* with errno set; EPROTO if the object is not a ring this header      */
+/* understands.                                                        */
+static inline int ttxd_shm_open(struct ttxd_shm *m, const char *name)
+{
+    char        path[256] = "/";
+    struct stat st;
+    void       *p;
+    int         fd;
+
+    strncat(path, name[0] == '/' ? name + 1 : name, sizeof(path) - 2);
+    fd = shm_open(path, O_RDONLY, 0);  /* FD_CLOEXEC is implied */
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0) { close(fd); return -1; }
+    if ((size_t)st.st_size < sizeof(struct ttxd_shm_header)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+
+    m->hdr  = (const struct ttxd_shm_header *)p;
+    m->size = (size_t)st.st_size;
+    if (memcmp(m->hdr->magic, TTXD_SHM_MAGIC, 4) != 0 ||
+        m->hdr->version != TTXD_SHM_VERSION ||
+        m->hdr->slot_size != sizeof(struct ttxd_shm_slot) ||
+        m->hdr->size > m->size) {
+        munmap(p, m->size);
+        m->hdr = NULL;
+        errno  = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void ttxd_shm_close(struct ttxd_shm *m)
+{
+    if (m->hdr) munmap((void *)m->hdr, m->size);
+    m->hdr = NULL;
+}
+
+/* Serial number the next page will get; pages head - nslots .. head-1 */
+/* are (at best) still in the ring                                     */
+static inline uint64_t ttxd_shm_head(const struct ttxd_shm *m)
+{
+    return __atomic_load_n(&m->hdr->head, __ATOMIC_ACQUIRE);
+}
+
+/* ttxd has exited.  A new run replaces the object, so reopen to       */
+/* follow it.                                                          */
+static inline int ttxd_shm_closed(const struct ttxd_shm *m)
+{
+    return __atomic_load_n(&m->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+/* Stream index for a UDP port as given on the command line, or -1    */
+static inline int ttxd_shm_stream(const struct ttxd_shm *m, int port)
+{
+    for (uint32_t i = 0; i < m->hdr->nstreams && i < TTXD_SHM_STREAMS; i++)
+        if (m->hdr->port[i] == port) return (int)i;
+    return -1;
+}
+
+/* Copy page number serial into *out.  Returns 1, or 0 if that page    */
+/* has not been written yet or has already been overwritten.           */
+static inline int ttxd_shm_read(const struct ttxd_shm *m, uint64_t serial,
+                                struct ttxd_shm_slot *out)
+{
+    const struct ttxd_shm_slot *s = (const struct ttxd_shm_slot *)(const void *)
+        ((const char *)m->hdr + m->hdr->slots +
+         (size_t)(serial & (m->hdr->nslots - 1)) * sizeof(*s));
+
+    /* The writer holds a slot for a few microseconds; if it died     */
+    /* inside one, give up rather than spin forever                    */
+    for (int tries = 0; tries < 100000; tries++) {
+        uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            continue;
+        }
+        memcpy(out, s, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+            return seq != 0 && out->serial == serial;
+    }
+    return 0;
+}
+
+/* Copy the newest copy of page pgno (any subpage) of a stream.        */
+/* Returns 1, or 0 if there is none in the ring.                       */
+static inline int ttxd_shm_latest(const struct ttxd_shm *m, int stream,
+                                  int pgno, struct ttxd_shm_slot *out)
+{
+    const uint64_t *index = (const uint64_t *)(const void *)
+        ((const char *)m->hdr + m->hdr->index);
+
+    if (stream < 0 || (uint32_t)stream >= m->hdr->nstreams ||
+        pgno < 100 || pgno >= 100 + TTXD_SHM_PAGES)
+        return 0;
+
+    /* Entries hold serial + 1, so 0 means never written.  Look again */
+    /* if the page was rewritten while we copied the older slot.       */
+    for (int tries = 0; tries < 4; tries++) {
+        uint64_t n = __atomic_load_n(&index[(size_t)stream * TTXD_SHM_PAGES +
+                                            (size_t)(pgno - 100)],
+                                     __ATOMIC_ACQUIRE);
+        if (n == 0) return 0;
+        if (ttxd_shm_read(m, n - 1, out)) return 1;
+    }
+    return 0;
+}
+
+#endif /* TTXD_SHM_H */
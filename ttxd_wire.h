@@ -0,0 +1,138 @@
+/*
+ * ttxd_wire.h  —  Binary page datagrams (--format=binary), and a
+ *                 reference decoder for them
+ *
+ * Each page is one UDP datagram: a fixed 32-byte header, then every
+ * row named in the header's row mask as a length byte followed by
+ * that many bytes of UTF-8.  The text is what the JSON "lines" hold
+ * (trailing spaces removed, nothing escaped), so a consumer needs
+ * neither a JSON parser nor any unescaping.
+ *
+ *   offset  size  field
+ *        0     2  magic "TX"
+ *        2     1  version, TTXD_WIRE_VERSION
+ *        3     1  flags, TTXD_WIRE_*
+ *        4     2  page, 100..899
+ *        6     2  subpage, 0 = none
+ *        8     4  rows: bit r set = row r follows
+ *       12     4  seq (--delta), valid with TTXD_WIRE_SEQ
+ *       16     8  PTS, 90 kHz, valid with TTXD_WIRE_PTS
+ *       24     8  ts, Unix time in seconds
+ *       32        rows, lowest first: u8 length, UTF-8 bytes
+ *
+ * With TTXD_WIRE_ATTRS (--attributes), each row's text is followed by
+ * its attribute spans: u8 count, then per span u8 column and u16
+ * attribute word (ttxd_attr.h).  A span runs up to the next one or the
+ * end of the row; the row starts as TTXD_ATTR_DEFAULT, so a row with
+ * no colours or effects costs one byte.
+ *
+ * Integers are little-endian.  A version 1 decoder rejects any other
+ * version and any flag it does not know, since flags can change the
+ * layout; fields added later go after ts.
+ *
+ * Other datagrams on the same port (the page index, --query replies)
+ * stay JSON and start with '{', so the first byte tells them apart.
+ *
+ * Header only, like hamming.h: ttxd.c includes it for the layout, and
+ * a consumer includes it for ttxd_wire_decode().
+ */
+#ifndef TTXD_WIRE_H
+#define TTXD_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ttxd_attr.h"
+
+#define TTXD_WIRE_MAGIC0    'T'
+#define TTXD_WIRE_MAGIC1    'X'
+#define TTXD_WIRE_VERSION   1
+#define TTXD_WIRE_HDR_SIZE  32
+#define TTXD_WIRE_ROWS      25
+
+/* Header flags                                                        */
+#define TTXD_WIRE_DELTA     0x01        /* rows are what changed only   */
+#define TTXD_WIRE_SEQ       0x02        /* seq is set                   */
+#define TTXD_WIRE_PTS       0x04        /* pts is set                   */
+#define TTXD_WIRE_ATTRS     0x08        /* attribute spans follow rows  */
+#define TTXD_WIRE_FLAGS     0x0F        /* all of the above             */
+
+/* A decoded datagram.  text[r] points into the datagram and is not    */
+/* NUL-terminated; it is NULL for a row the datagram does not carry.   */
+/* span[r] points at nspan[r] packed spans; see ttxd_wire_span().      */
+struct ttxd_wire_page {
+    int                 page;
+    int                 subpage;
+    unsigned            flags;
+    uint32_t            rows;
+    uint32_t            seq;
+    uint64_t            pts;
+    int64_t             ts;
+    const char         *text[TTXD_WIRE_ROWS];
+    int                 len[TTXD_WIRE_ROWS];
+    const uint8_t      *span[TTXD_WIRE_ROWS];
+    int                 nspan[TTXD_WIRE_ROWS];
+};
+
+static inline uint64_t ttxd_wire_get(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+    while (n--) v = v << 8 | p[n];
+    return v;
+}
+
+/* Decode one datagram.  Returns 0, or -1 if it is not a version 1     */
+/* page (for instance a JSON datagram) or is cut short.                */
+static inline int ttxd_wire_decode(const void *buf, size_t n,
+                                   struct ttxd_wire_page *pg)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    size_t         off = TTXD_WIRE_HDR_SIZE;
+
+    if (n < TTXD_WIRE_HDR_SIZE || p[0] != TTXD_WIRE_MAGIC0 ||
+        p[1] != TTXD_WIRE_MAGIC1 || p[2] != TTXD_WIRE_VERSION ||
+        (p[3] & ~TTXD_WIRE_FLAGS))
+        return -1;
+
+    pg->flags   = p[3];
+    pg->page    = (int)ttxd_wire_get(p + 4, 2);
+    pg->subpage = (int)ttxd_wire_get(p + 6, 2);
+    pg->rows    = (uint32_t)ttxd_wire_get(p + 8, 4);
+    pg->seq     = (uint32_t)ttxd_wire_get(p + 12, 4);
+    pg->pts     = ttxd_wire_get(p + 16, 8);
+    pg->ts      = (int64_t)ttxd_wire_get(p + 24, 8);
+
+    for (int r = 0; r < TTXD_WIRE_ROWS; r++) {
+        pg->text[r]  = NULL;
+        pg->len[r]   = 0;
+        pg->span[r]  = NULL;
+        pg->nspan[r] = 0;
+        if (!(pg->rows >> r & 1))
+            continue;
+        if (off >= n || off + 1 + p[off] > n)
+            return -1;
+        pg->len[r]  = p[off];
+        pg->text[r] = (const char *)p + off + 1;
+        off += 1 + (size_t)p[off];
+
+        if (!(pg->flags & TTXD_WIRE_ATTRS))
+            continue;
+        if (off >= n || off + 1 + 3 * (size_t)p[off] > n)
+            return -1;
+        pg->nspan[r] = p[off];
+        pg->span[r]  = p + off + 1;
+        off += 1 + 3 * (size_t)p[off];
+    }
+    return 0;
+}
+
+/* Span i of a row: the column it starts at and its attribute word     */
+static inline void ttxd_wire_span(const struct ttxd_wire_page *pg, int row,
+                                  int i, int *col, unsigned *attr)
+{
+    const uint8_t *s = pg->span[row] + 3 * i;
+    *col  = s[0];
+    *attr = (unsigned)ttxd_wire_get(s + 1, 2);
+}
+
+#endif /* TTXD_WIRE_H */